@@ -150,12 +150,21 @@ static const GitEventcDefaultShortener _git_eventc_default_shorteners_low[] = {
 };
 
 static GitEventcShortener *_git_eventc_shorteners = NULL;
+static GKeyFile *_git_eventc_shorteners_key_file = NULL;
+static gboolean _git_eventc_shorteners_parsed = FALSE;
 
 static gchar *host = NULL;
 static guint merge_threshold = 5;
 static gboolean shortener = FALSE;
 
 static gboolean should_reconnect = TRUE;
+static gboolean send_failed = FALSE;
+static gboolean connecting = FALSE;
+static gboolean disconnect_on_connect = FALSE;
+static GMainLoop *client_loop = NULL;
+static GQueue pending_events = G_QUEUE_INIT;
+static gint64 shortener_time = 0;
+static gint64 send_time = 0;
 static EventcConnection *client = NULL;
 static SoupSession *shortener_session = NULL;
 static guint retry_timeout = 0;
@@ -352,7 +361,7 @@ _git_eventc_shorteners_parse(GKeyFile *key_file, GError **error)
         sections = g_key_file_get_groups(key_file, &l);
     if ( sections != NULL )
     {
-        list = g_newa(gchar *, l);
+        list = g_newa(gchar *, l + 1);
         for ( section = sections, l = 0 ; *section != NULL ; ++section )
         {
             if ( g_str_has_prefix(*section, "shortener ") )
@@ -448,12 +457,6 @@ git_eventc_parse_options(gint *argc, gchar ***argv, const gchar *group, GOptionE
             }
         }
     }
-    if ( ! _git_eventc_shorteners_parse(key_file, &error) )
-    {
-        g_warning("Config file parsing failed: %s\n", error->message);
-        goto out;
-    }
-
     option_context = g_option_context_new(description);
 
     if ( extra_entries != NULL )
@@ -467,6 +470,10 @@ git_eventc_parse_options(gint *argc, gchar ***argv, const gchar *group, GOptionE
     }
     g_option_context_free(option_context);
 
+    /* Shorteners are only parsed on first use */
+    if ( shortener && ( key_file != NULL ) )
+        _git_eventc_shorteners_key_file = g_key_file_ref(key_file);
+
     ret = TRUE;
 
 out:
@@ -526,8 +533,8 @@ _git_eventc_stop(gpointer user_data)
 }
 #endif /* G_OS_UNIX */
 
-gboolean
-git_eventc_init(GMainLoop *loop, gint *retval)
+static gboolean
+_git_eventc_client_new(GMainLoop *loop, gint *retval)
 {
 #ifdef GIT_EVENTC_DEBUG_OUTPUT
     g_setenv("G_MESSAGES_DEBUG", "all", FALSE);
@@ -538,6 +545,8 @@ git_eventc_init(GMainLoop *loop, gint *retval)
     g_unix_signal_add(SIGINT, _git_eventc_stop, loop);
 #endif /* G_OS_UNIX */
 
+    client_loop = loop;
+
     GError *error = NULL;
     client = eventc_connection_new(host, &error);
     if ( client == NULL )
@@ -548,6 +557,27 @@ git_eventc_init(GMainLoop *loop, gint *retval)
         return FALSE;
     }
 
+#ifdef GIT_EVENTC_DEBUG_OUTPUT
+#define bstring(b) ((b) ? "true" : "false")
+    g_debug("Configuration:"
+        "\n    Merge threshold: %d"
+        "\n    Use shortener: %s"
+        "\n",
+        merge_threshold,
+        bstring(shortener)
+    );
+#endif /* GIT_EVENTC_DEBUG_OUTPUT */
+
+    return TRUE;
+}
+
+gboolean
+git_eventc_init(GMainLoop *loop, gint *retval)
+{
+    if ( ! _git_eventc_client_new(loop, retval) )
+        return FALSE;
+
+    GError *error = NULL;
     if ( ! eventc_connection_connect_sync(client, &error) )
     {
         g_warning("Couldn't connect to eventd: %s", error->message);
@@ -559,16 +589,96 @@ git_eventc_init(GMainLoop *loop, gint *retval)
     }
     g_signal_connect(client, "disconnected", G_CALLBACK(_git_eventc_disconnected), loop);
 
-#ifdef GIT_EVENTC_DEBUG_OUTPUT
-#define bstring(b) ((b) ? "true" : "false")
-    g_debug("Configuration:"
-        "\n    Merge threshold: %d"
-        "\n    Use shortener: %s"
-        "\n",
-        merge_threshold,
-        bstring(shortener)
-    );
-#endif /* GIT_EVENTC_DEBUG_OUTPUT */
+    return TRUE;
+}
+
+typedef struct {
+    GMainLoop *loop;
+} GitEventcConnectData;
+
+static void
+_git_eventc_connect_callback(GObject *obj, GAsyncResult *res, gpointer user_data)
+{
+    GitEventcConnectData *data = user_data;
+    GError *error = NULL;
+    EventdEvent *event;
+
+    connecting = FALSE;
+    if ( ! eventc_connection_connect_finish(client, res, &error) )
+    {
+        g_warning("Couldn't connect to eventd: %s", error->message);
+        g_error_free(error);
+        g_queue_clear_full(&pending_events, (GDestroyNotify) eventd_event_unref);
+        /* The caller exits with 2 once it sees the send status, as with git_eventc_init() */
+        send_failed = TRUE;
+        /* Nothing to wait for, quit as soon as we are asked to disconnect */
+        if ( disconnect_on_connect )
+            git_eventc_disconnect();
+        goto out;
+    }
+    g_signal_connect(client, "disconnected", G_CALLBACK(_git_eventc_disconnected), data->loop);
+
+    gint64 start = g_get_monotonic_time();
+    while ( ( event = g_queue_pop_head(&pending_events) ) != NULL )
+    {
+        if ( ! eventc_connection_send_event(client, event, NULL) )
+            send_failed = TRUE;
+        eventd_event_unref(event);
+    }
+    send_time += g_get_monotonic_time() - start;
+
+    if ( disconnect_on_connect )
+        git_eventc_disconnect();
+
+out:
+    g_slice_free(GitEventcConnectData, data);
+}
+
+gboolean
+git_eventc_init_async(GMainLoop *loop, gint *retval)
+{
+    if ( ! _git_eventc_client_new(loop, retval) )
+        return FALSE;
+
+    GitEventcConnectData *data;
+    data = g_slice_new(GitEventcConnectData);
+    data->loop = loop;
+
+    /* Events are queued until we are connected */
+    connecting = TRUE;
+    eventc_connection_connect(client, _git_eventc_connect_callback, data);
+
+    return TRUE;
+}
+
+void
+git_eventc_poll(void)
+{
+    while ( connecting && g_main_context_iteration(NULL, FALSE) );
+}
+
+void
+git_eventc_wait_connection(void)
+{
+    while ( connecting )
+        g_main_context_iteration(NULL, TRUE);
+}
+
+gboolean
+git_eventc_connect(void)
+{
+    GError *error = NULL;
+
+    should_reconnect = TRUE;
+    if ( eventc_connection_is_connected(client, NULL) )
+        return TRUE;
+
+    if ( ! eventc_connection_connect_sync(client, &error) )
+    {
+        g_warning("Couldn't connect to eventd: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
 
     return TRUE;
 }
@@ -577,9 +687,34 @@ void
 git_eventc_disconnect(void)
 {
     should_reconnect = FALSE;
+    if ( connecting )
+    {
+        disconnect_on_connect = TRUE;
+        return;
+    }
+    if ( ! eventc_connection_is_connected(client, NULL) )
+    {
+        /* Never connected or dropped on us, "disconnected" will not come */
+        if ( retry_timeout != 0 )
+        {
+            g_source_remove(retry_timeout);
+            retry_timeout = 0;
+        }
+        send_failed = TRUE;
+        g_main_loop_quit(client_loop);
+        return;
+    }
     eventc_connection_close(client, NULL);
 }
 
+gboolean
+git_eventc_reset_send_status(void)
+{
+    gboolean ret = ! send_failed;
+    send_failed = FALSE;
+    return ret;
+}
+
 void
 git_eventc_uninit(void)
 {
@@ -598,7 +733,10 @@ git_eventc_uninit(void)
         g_free(shortener->header);
     }
     g_free(_git_eventc_shorteners);
+    if ( _git_eventc_shorteners_key_file != NULL )
+        g_key_file_unref(_git_eventc_shorteners_key_file);
 
+    g_queue_clear_full(&pending_events, (GDestroyNotify) eventd_event_unref);
     if ( client != NULL )
         g_object_unref(client);
 
@@ -617,6 +755,24 @@ _git_eventc_get_url(gchar *url, gboolean copy)
     if ( ( ! shortener ) || ( url == NULL ) || ( *url == '\0') )
         return copy ? g_strdup(url) : url;
 
+    if ( ! _git_eventc_shorteners_parsed )
+    {
+        GError *error = NULL;
+
+        _git_eventc_shorteners_parsed = TRUE;
+        if ( ! _git_eventc_shorteners_parse(_git_eventc_shorteners_key_file, &error) )
+        {
+            g_warning("Config file parsing failed, not using shorteners: %s", error->message);
+            g_error_free(error);
+            shortener = FALSE;
+        }
+        if ( _git_eventc_shorteners_key_file != NULL )
+            g_key_file_unref(_git_eventc_shorteners_key_file);
+        _git_eventc_shorteners_key_file = NULL;
+        if ( ! shortener )
+            return copy ? g_strdup(url) : url;
+    }
+
     if ( shortener_session == NULL )
     {
         shortener_session = soup_session_new();
@@ -683,13 +839,27 @@ _git_eventc_get_url(gchar *url, gboolean copy)
 gchar *
 git_eventc_get_url_const(const gchar *url)
 {
-    return _git_eventc_get_url((gchar *) url, TRUE);
+    gint64 start = g_get_monotonic_time();
+    gchar *ret = _git_eventc_get_url((gchar *) url, TRUE);
+    shortener_time += g_get_monotonic_time() - start;
+    return ret;
 }
 
 gchar *
 git_eventc_get_url(gchar *url)
 {
-    return _git_eventc_get_url((gchar *) url, FALSE);
+    gint64 start = g_get_monotonic_time();
+    gchar *ret = _git_eventc_get_url((gchar *) url, FALSE);
+    shortener_time += g_get_monotonic_time() - start;
+    return ret;
+}
+
+void
+git_eventc_take_timings(gint64 *shortener, gint64 *send)
+{
+    *shortener = shortener_time;
+    *send = send_time;
+    shortener_time = send_time = 0;
 }
 
 static void
@@ -817,7 +987,16 @@ _git_eventc_send_event(EventdEvent *event, const GitEventcEventBase *base, va_li
             eventd_event_add_data(event, g_strdup(extra_data), extra_value);
     }
 
-    eventc_connection_send_event(client, event, NULL);
+    if ( connecting )
+    {
+        g_queue_push_tail(&pending_events, event);
+        return;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    if ( ! eventc_connection_send_event(client, event, NULL) )
+        send_failed = TRUE;
+    send_time += g_get_monotonic_time() - start;
     eventd_event_unref(event);
 }
 
@@ -1000,6 +1179,19 @@ git_eventc_send_push(const GitEventcEventBase *base, const gchar *pusher_name, c
     va_end(extra);
 }
 
+void
+git_eventc_send_stats(const GitEventcEventBase *base, ...)
+{
+    EventdEvent *event;
+
+    event = eventd_event_new(PACKAGE_NAME, "stats");
+
+    va_list extra;
+    va_start(extra, base);
+    _git_eventc_send_event(event, base, extra);
+    va_end(extra);
+}
+
 void
 git_eventc_send_issue(const GitEventcEventBase *base, const gchar *action, guint64 id, const gchar *title, const gchar *author_name, const gchar *author_username, const gchar *author_email, GVariant *tags, ...)
 {
@@ -55,13 +55,19 @@ gchar *git_eventc_get_files(GList *paths);
 typedef gboolean (*GitEventcKeyFileFunc)(GKeyFile *key_file, GError **error);
 gboolean git_eventc_parse_options(gint *argc, gchar ***argv, const gchar *group, GOptionEntry *extra_entries, const gchar *description, GitEventcKeyFileFunc extra_parsing, gboolean *print_version);
 gboolean git_eventc_init(GMainLoop *loop, gint *retval);
+gboolean git_eventc_init_async(GMainLoop *loop, gint *retval);
+void git_eventc_poll(void);
+void git_eventc_wait_connection(void);
+gboolean git_eventc_connect(void);
 void git_eventc_disconnect(void);
+gboolean git_eventc_reset_send_status(void);
 void git_eventc_uninit(void);
 
 gboolean git_eventc_is_above_threshold(guint size);
 
 gchar *git_eventc_get_url(gchar *url);
 gchar *git_eventc_get_url_const(const gchar *url);
+void git_eventc_take_timings(gint64 *shortener, gint64 *send);
 
 typedef struct {
     const gchar **project;
@@ -88,6 +94,8 @@ G_GNUC_NULL_TERMINATED
 void git_eventc_send_commit(const GitEventcEventBase *base, const gchar *id, const gchar *base_message, const gchar *pusher_name, const gchar *pusher_username, const gchar *pusher_email, const gchar *author_name, const gchar *author_username, const gchar *author_email, const gchar *branch, const gchar *files, ...);
 G_GNUC_NULL_TERMINATED
 void git_eventc_send_push(const GitEventcEventBase *base, const gchar *pusher_name, const gchar *pusher_username, const gchar *pusher_email, const gchar *branch, ...);
+G_GNUC_NULL_TERMINATED
+void git_eventc_send_stats(const GitEventcEventBase *base, ...);
 
 G_GNUC_NULL_TERMINATED
 void git_eventc_send_issue(const GitEventcEventBase *base, const gchar *action, guint64 id, const gchar *title, const gchar *author_name, const gchar *author_username, const gchar *author_email, GVariant *tags, ...);
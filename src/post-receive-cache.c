@@ -0,0 +1,487 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <git2.h>
+
+#include "post-receive-cache.h"
+
+/*
+ * The cache file is a magic string followed by records:
+ *     record magic | raw object id | length | flags | checksum | files
+ * All integers are little-endian 32-bit, the checksum is a FNV-1a hash
+ * of the id, length, flags and files.
+ * It is only ever appended to, under a lock, and rewritten with its
+ * newest half once it grows past its maximum size.
+ * Readers map it and index the valid records, a record being written
+ * at the end is simply ignored.
+ * Anything after the first broken record (e.g. a crashed writer) is
+ * truncated, under the lock, so later appends stay aligned.
+ */
+#define CACHE_MAGIC "git-eventc files 4\n"
+#define CACHE_MAGIC_LENGTH (sizeof(CACHE_MAGIC) - 1)
+#define CACHE_RECORD_MAGIC "GEfr"
+#define CACHE_RECORD_MAGIC_LENGTH (sizeof(CACHE_RECORD_MAGIC) - 1)
+#define CACHE_RECORD_ID_OFFSET CACHE_RECORD_MAGIC_LENGTH
+#define CACHE_RECORD_LENGTH_OFFSET (CACHE_RECORD_ID_OFFSET + GIT_OID_RAWSZ)
+#define CACHE_RECORD_FLAGS_OFFSET (CACHE_RECORD_LENGTH_OFFSET + sizeof(guint32))
+#define CACHE_RECORD_CHECKSUM_OFFSET (CACHE_RECORD_FLAGS_OFFSET + sizeof(guint32))
+#define CACHE_RECORD_HEADER_LENGTH (CACHE_RECORD_CHECKSUM_OFFSET + sizeof(guint32))
+
+struct _GitEventcPostReceiveCache {
+    GMutex mutex;
+    gchar *path;
+    gsize max_size;
+    GMappedFile *file;
+    dev_t dev;
+    ino_t ino;
+    gsize indexed;
+    gboolean damaged;
+    GHashTable *index;
+};
+
+static guint
+_git_eventc_post_receive_cache_oid_hash(gconstpointer key)
+{
+    const git_oid *id = key;
+    guint hash;
+
+    memcpy(&hash, id->id, sizeof(hash));
+    return hash;
+}
+
+static gboolean
+_git_eventc_post_receive_cache_oid_equal(gconstpointer a, gconstpointer b)
+{
+    return ( git_oid_equal(a, b) != 0 );
+}
+
+static void
+_git_eventc_post_receive_cache_oid_free(gpointer data)
+{
+    g_slice_free(git_oid, data);
+}
+
+static guint32
+_git_eventc_post_receive_cache_record_get(const gchar *data, gsize offset, gsize field)
+{
+    guint32 value;
+
+    memcpy(&value, data + offset + field, sizeof(value));
+    return GUINT32_FROM_LE(value);
+}
+
+static guint32
+_git_eventc_post_receive_cache_hash(guint32 hash, const gchar *data, gsize length)
+{
+    gsize i;
+
+    for ( i = 0 ; i < length ; ++i )
+    {
+        hash ^= (guchar) data[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static guint32
+_git_eventc_post_receive_cache_checksum(const gchar *record, gsize length)
+{
+    guint32 hash = 2166136261U;
+
+    hash = _git_eventc_post_receive_cache_hash(hash, record + CACHE_RECORD_ID_OFFSET, CACHE_RECORD_CHECKSUM_OFFSET - CACHE_RECORD_ID_OFFSET);
+    return _git_eventc_post_receive_cache_hash(hash, record + CACHE_RECORD_HEADER_LENGTH, length);
+}
+
+/*
+ * Returns the whole record length if valid, 0 if it is not complete
+ * (yet), and -1 if it is broken
+ */
+static gssize
+_git_eventc_post_receive_cache_record_check(const gchar *data, gsize size, gsize offset)
+{
+    gsize length;
+
+    if ( offset + CACHE_RECORD_MAGIC_LENGTH > size )
+        return ( memcmp(data + offset, CACHE_RECORD_MAGIC, size - offset) == 0 ) ? 0 : -1;
+    if ( memcmp(data + offset, CACHE_RECORD_MAGIC, CACHE_RECORD_MAGIC_LENGTH) != 0 )
+        return -1;
+    if ( offset + CACHE_RECORD_HEADER_LENGTH > size )
+        return 0;
+
+    length = _git_eventc_post_receive_cache_record_get(data, offset, CACHE_RECORD_LENGTH_OFFSET);
+    if ( length > size - offset - CACHE_RECORD_HEADER_LENGTH )
+        return 0;
+    if ( _git_eventc_post_receive_cache_checksum(data + offset, length) != _git_eventc_post_receive_cache_record_get(data, offset, CACHE_RECORD_CHECKSUM_OFFSET) )
+        return -1;
+
+    return CACHE_RECORD_HEADER_LENGTH + length;
+}
+
+static void
+_git_eventc_post_receive_cache_index(GitEventcPostReceiveCache *self)
+{
+    const gchar *data = g_mapped_file_get_contents(self->file);
+    gsize size = g_mapped_file_get_length(self->file);
+    gsize offset = self->indexed;
+    gssize length = 0;
+
+    while ( ( offset < size ) && ( ( length = _git_eventc_post_receive_cache_record_check(data, size, offset) ) > 0 ) )
+    {
+        git_oid *id = g_slice_new(git_oid);
+        git_oid_fromraw(id, (const unsigned char *) data + offset + CACHE_RECORD_ID_OFFSET);
+        g_hash_table_replace(self->index, id, GSIZE_TO_POINTER(offset));
+
+        offset += length;
+    }
+    self->indexed = offset;
+    self->damaged = ( length < 0 );
+}
+
+static void
+_git_eventc_post_receive_cache_reload(GitEventcPostReceiveCache *self)
+{
+    GError *error = NULL;
+    GMappedFile *file;
+    GStatBuf st;
+    gint fd;
+
+    fd = g_open(self->path, O_RDONLY | O_CLOEXEC, 0);
+    if ( fd < 0 )
+        return;
+    if ( fstat(fd, &st) < 0 )
+        goto out;
+
+    if ( ( self->file != NULL ) && ( ( st.st_dev != self->dev ) || ( st.st_ino != self->ino ) || ( (gsize) st.st_size < self->indexed ) ) )
+    {
+        /* Compacted by someone else */
+        g_mapped_file_unref(self->file);
+        self->file = NULL;
+        g_hash_table_remove_all(self->index);
+        self->indexed = 0;
+    }
+
+    if ( (gsize) st.st_size < CACHE_MAGIC_LENGTH )
+        goto out;
+    if ( ( self->file != NULL ) && ( (gsize) st.st_size == g_mapped_file_get_length(self->file) ) )
+        goto out;
+
+    file = g_mapped_file_new_from_fd(fd, FALSE, &error);
+    if ( file == NULL )
+    {
+        g_warning("Couldn't map files cache %s: %s", self->path, error->message);
+        g_clear_error(&error);
+        goto out;
+    }
+
+    if ( ( self->indexed == 0 ) && ( memcmp(g_mapped_file_get_contents(file), CACHE_MAGIC, CACHE_MAGIC_LENGTH) != 0 ) )
+    {
+        /* Corrupted or from another version, start over */
+        g_warning("Files cache %s is invalid, removing it", self->path);
+        g_mapped_file_unref(file);
+        g_unlink(self->path);
+        goto out;
+    }
+
+    if ( self->file != NULL )
+        g_mapped_file_unref(self->file);
+    self->file = file;
+    self->dev = st.st_dev;
+    self->ino = st.st_ino;
+    self->indexed = MAX(self->indexed, CACHE_MAGIC_LENGTH);
+    _git_eventc_post_receive_cache_index(self);
+
+out:
+    g_close(fd, NULL);
+}
+
+/*
+ * Must be called with the file lock held, so nobody is appending:
+ * anything after our last valid record is broken
+ */
+static void
+_git_eventc_post_receive_cache_truncate(GitEventcPostReceiveCache *self, gint fd, GStatBuf *st)
+{
+    _git_eventc_post_receive_cache_reload(self);
+    if ( ( self->file == NULL ) || ( st->st_dev != self->dev ) || ( st->st_ino != self->ino ) || ( (gsize) st->st_size <= self->indexed ) )
+        return;
+
+    g_warning("Files cache %s is broken at %" G_GSIZE_FORMAT ", truncating it", self->path, self->indexed);
+    if ( ftruncate(fd, self->indexed) < 0 )
+    {
+        g_warning("Couldn't truncate files cache %s: %s", self->path, g_strerror(errno));
+        return;
+    }
+    st->st_size = self->indexed;
+    self->damaged = FALSE;
+}
+
+static void
+_git_eventc_post_receive_cache_repair(GitEventcPostReceiveCache *self)
+{
+    GStatBuf st;
+    gint fd;
+
+    fd = g_open(self->path, O_WRONLY | O_CLOEXEC, 0);
+    if ( fd < 0 )
+        return;
+    if ( ( flock(fd, LOCK_EX) == 0 ) && ( fstat(fd, &st) == 0 ) )
+        _git_eventc_post_receive_cache_truncate(self, fd, &st);
+    g_close(fd, NULL);
+}
+
+static void
+_git_eventc_post_receive_cache_refresh(GitEventcPostReceiveCache *self)
+{
+    _git_eventc_post_receive_cache_reload(self);
+    if ( self->damaged )
+        _git_eventc_post_receive_cache_repair(self);
+}
+
+GitEventcPostReceiveCache *
+git_eventc_post_receive_cache_new(const gchar *directory, const gchar *key, gsize max_size)
+{
+    GitEventcPostReceiveCache *self;
+    gchar *name;
+
+    if ( g_mkdir_with_parents(directory, 0755) < 0 )
+    {
+        g_warning("Couldn't create files cache directory %s: %s", directory, g_strerror(errno));
+        return NULL;
+    }
+
+    self = g_slice_new0(GitEventcPostReceiveCache);
+    g_mutex_init(&self->mutex);
+
+    /* Different diff options give different results */
+    name = g_strdup_printf("files-%s.cache", key);
+    self->path = g_build_filename(directory, name, NULL);
+    g_free(name);
+
+    self->max_size = MAX(max_size, CACHE_MAGIC_LENGTH + CACHE_RECORD_HEADER_LENGTH);
+    self->index = g_hash_table_new_full(_git_eventc_post_receive_cache_oid_hash, _git_eventc_post_receive_cache_oid_equal, _git_eventc_post_receive_cache_oid_free, NULL);
+
+    _git_eventc_post_receive_cache_refresh(self);
+
+    return self;
+}
+
+void
+git_eventc_post_receive_cache_free(GitEventcPostReceiveCache *self)
+{
+    if ( self == NULL )
+        return;
+
+    g_hash_table_unref(self->index);
+    if ( self->file != NULL )
+        g_mapped_file_unref(self->file);
+    g_free(self->path);
+    g_mutex_clear(&self->mutex);
+
+    g_slice_free(GitEventcPostReceiveCache, self);
+}
+
+gboolean
+git_eventc_post_receive_cache_lookup(GitEventcPostReceiveCache *self, const git_oid *id, gchar **files, guint32 *flags)
+{
+    gpointer offset_;
+    gboolean found;
+
+    g_mutex_lock(&self->mutex);
+
+    found = g_hash_table_lookup_extended(self->index, id, NULL, &offset_);
+    if ( ! found )
+    {
+        /* Maybe another hook stored it since */
+        _git_eventc_post_receive_cache_refresh(self);
+        found = g_hash_table_lookup_extended(self->index, id, NULL, &offset_);
+    }
+
+    if ( found )
+    {
+        const gchar *data = g_mapped_file_get_contents(self->file);
+        gsize offset = GPOINTER_TO_SIZE(offset_);
+        gsize length = _git_eventc_post_receive_cache_record_get(data, offset, CACHE_RECORD_LENGTH_OFFSET);
+
+        *files = ( length > 0 ) ? g_strndup(data + offset + CACHE_RECORD_HEADER_LENGTH, length) : NULL;
+        *flags = _git_eventc_post_receive_cache_record_get(data, offset, CACHE_RECORD_FLAGS_OFFSET);
+    }
+
+    g_mutex_unlock(&self->mutex);
+
+    return found;
+}
+
+static gboolean
+_git_eventc_post_receive_cache_compact(GitEventcPostReceiveCache *self)
+{
+    GError *error = NULL;
+    gchar *data;
+    gsize size, length, offset = CACHE_MAGIC_LENGTH;
+    gssize record_length;
+    gboolean ret;
+
+    if ( ! g_file_get_contents(self->path, &data, &size, &error) )
+    {
+        g_warning("Couldn't read files cache %s: %s", self->path, error->message);
+        g_clear_error(&error);
+        return FALSE;
+    }
+
+    if ( ( size < CACHE_MAGIC_LENGTH ) || ( memcmp(data, CACHE_MAGIC, CACHE_MAGIC_LENGTH) != 0 ) )
+    {
+        /* Not ours, start over */
+        g_free(data);
+        data = g_strdup(CACHE_MAGIC);
+        size = length = offset;
+    }
+    else
+    {
+        /* Never copy a broken tail along */
+        length = offset;
+        while ( ( length < size ) && ( ( record_length = _git_eventc_post_receive_cache_record_check(data, size, length) ) > 0 ) )
+            length += record_length;
+    }
+
+    /* Keep the newest records, up to half the size */
+    while ( ( offset < length ) && ( length - offset > self->max_size / 2 ) )
+        offset += CACHE_RECORD_HEADER_LENGTH + _git_eventc_post_receive_cache_record_get(data, offset, CACHE_RECORD_LENGTH_OFFSET);
+
+    offset -= CACHE_MAGIC_LENGTH;
+    memcpy(data + offset, CACHE_MAGIC, CACHE_MAGIC_LENGTH);
+
+    ret = g_file_set_contents_full(self->path, data + offset, length - offset, G_FILE_SET_CONTENTS_CONSISTENT, 0644, &error);
+    if ( ! ret )
+    {
+        g_warning("Couldn't compact files cache %s: %s", self->path, error->message);
+        g_clear_error(&error);
+    }
+    g_free(data);
+
+    return ret;
+}
+
+static gboolean
+_git_eventc_post_receive_cache_write(gint fd, const gchar *data, gsize length)
+{
+    while ( length > 0 )
+    {
+        gssize r = write(fd, data, length);
+        if ( r < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            return FALSE;
+        }
+        data += r;
+        length -= r;
+    }
+    return TRUE;
+}
+
+void
+git_eventc_post_receive_cache_store(GitEventcPostReceiveCache *self, const git_oid *id, const gchar *files, guint32 flags)
+{
+    gsize length = ( files != NULL ) ? strlen(files) : 0;
+    guint32 length_le = GUINT32_TO_LE(length);
+    guint32 flags_le = GUINT32_TO_LE(flags);
+    guint32 checksum_le;
+    GStatBuf fst, st;
+    gint fd;
+
+    /* Compaction keeps up to half the size, the record must fit next to it */
+    gsize record_length = CACHE_RECORD_HEADER_LENGTH + length;
+    if ( ( length > G_MAXUINT32 ) || ( CACHE_MAGIC_LENGTH + record_length > self->max_size / 2 ) )
+        return;
+
+    gchar *record = g_malloc(record_length);
+    memcpy(record, CACHE_RECORD_MAGIC, CACHE_RECORD_MAGIC_LENGTH);
+    memcpy(record + CACHE_RECORD_ID_OFFSET, id->id, GIT_OID_RAWSZ);
+    memcpy(record + CACHE_RECORD_LENGTH_OFFSET, &length_le, sizeof(length_le));
+    memcpy(record + CACHE_RECORD_FLAGS_OFFSET, &flags_le, sizeof(flags_le));
+    if ( length > 0 )
+        memcpy(record + CACHE_RECORD_HEADER_LENGTH, files, length);
+    checksum_le = GUINT32_TO_LE(_git_eventc_post_receive_cache_checksum(record, length));
+    memcpy(record + CACHE_RECORD_CHECKSUM_OFFSET, &checksum_le, sizeof(checksum_le));
+
+    /* We reload our mapping to find the end of the valid records */
+    g_mutex_lock(&self->mutex);
+
+    for (;;)
+    {
+        fd = g_open(self->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if ( fd < 0 )
+        {
+            g_warning("Couldn't open files cache %s: %s", self->path, g_strerror(errno));
+            goto out;
+        }
+        if ( ( flock(fd, LOCK_EX) < 0 ) || ( fstat(fd, &fst) < 0 ) || ( g_stat(self->path, &st) < 0 ) )
+        {
+            g_warning("Couldn't lock files cache %s: %s", self->path, g_strerror(errno));
+            goto close;
+        }
+
+        /* Another hook may have compacted it while we waited for the lock */
+        if ( ( fst.st_dev != st.st_dev ) || ( fst.st_ino != st.st_ino ) )
+        {
+            g_close(fd, NULL);
+            continue;
+        }
+
+        if ( ( fst.st_size > 0 ) && ( (gsize) fst.st_size + record_length > self->max_size ) )
+        {
+            /* The file is replaced, retry with the new one */
+            if ( ! _git_eventc_post_receive_cache_compact(self) )
+                goto close;
+            g_close(fd, NULL);
+            continue;
+        }
+
+        break;
+    }
+
+    /* Do not append after a broken record, it would never be read */
+    if ( fst.st_size > 0 )
+        _git_eventc_post_receive_cache_truncate(self, fd, &fst);
+
+    if ( ( fst.st_size == 0 ) && ( ! _git_eventc_post_receive_cache_write(fd, CACHE_MAGIC, CACHE_MAGIC_LENGTH) ) )
+        g_warning("Couldn't write files cache %s: %s", self->path, g_strerror(errno));
+    else if ( ! _git_eventc_post_receive_cache_write(fd, record, record_length) )
+        g_warning("Couldn't write files cache %s: %s", self->path, g_strerror(errno));
+
+close:
+    g_close(fd, NULL);
+out:
+    g_mutex_unlock(&self->mutex);
+    g_free(record);
+}
@@ -0,0 +1,41 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GIT_EVENTC_POST_RECEIVE_CACHE_H__
+#define __GIT_EVENTC_POST_RECEIVE_CACHE_H__
+
+typedef struct _GitEventcPostReceiveCache GitEventcPostReceiveCache;
+
+typedef enum {
+    GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED = (1 << 0),
+    GIT_EVENTC_POST_RECEIVE_CACHE_FIND_RENAMES = (1 << 1),
+    GIT_EVENTC_POST_RECEIVE_CACHE_FIND_COPIES = (1 << 2),
+    GIT_EVENTC_POST_RECEIVE_CACHE_FIND_MASK = GIT_EVENTC_POST_RECEIVE_CACHE_FIND_RENAMES | GIT_EVENTC_POST_RECEIVE_CACHE_FIND_COPIES,
+} GitEventcPostReceiveCacheFlags;
+
+GitEventcPostReceiveCache *git_eventc_post_receive_cache_new(const gchar *directory, const gchar *key, gsize max_size);
+void git_eventc_post_receive_cache_free(GitEventcPostReceiveCache *self);
+
+gboolean git_eventc_post_receive_cache_lookup(GitEventcPostReceiveCache *self, const git_oid *id, gchar **files, guint32 *flags);
+void git_eventc_post_receive_cache_store(GitEventcPostReceiveCache *self, const git_oid *id, const gchar *files, guint32 flags);
+
+#endif /* __GIT_EVENTC_POST_RECEIVE_CACHE_H__ */
@@ -0,0 +1,214 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "post-receive-ref-filter.h"
+
+/*
+ * Patterns are compiled once to the cheapest matcher that handles them:
+ * most are either a full ref name or a prefix ("refs/heads/" and a star), only
+ * the others need a GPatternSpec.
+ * A ref is kept if it matches an include pattern (or if there are none)
+ * and no exclude pattern.
+ */
+typedef enum {
+    GIT_EVENTC_POST_RECEIVE_REF_PATTERN_EXACT,
+    GIT_EVENTC_POST_RECEIVE_REF_PATTERN_PREFIX,
+    GIT_EVENTC_POST_RECEIVE_REF_PATTERN_GLOB,
+} GitEventcPostReceiveRefPatternType;
+
+typedef struct {
+    GitEventcPostReceiveRefPatternType type;
+    gchar *string;
+    gsize length;
+    GPatternSpec *spec;
+} GitEventcPostReceiveRefPattern;
+
+struct _GitEventcPostReceiveRefFilter {
+    GArray *include;
+    GArray *exclude;
+};
+
+static void
+_git_eventc_post_receive_ref_pattern_clear(gpointer data)
+{
+    GitEventcPostReceiveRefPattern *pattern = data;
+
+    if ( pattern->spec != NULL )
+        g_pattern_spec_free(pattern->spec);
+    g_free(pattern->string);
+}
+
+static GArray *
+_git_eventc_post_receive_ref_patterns_new(void)
+{
+    GArray *patterns;
+
+    patterns = g_array_new(FALSE, FALSE, sizeof(GitEventcPostReceiveRefPattern));
+    g_array_set_clear_func(patterns, _git_eventc_post_receive_ref_pattern_clear);
+
+    return patterns;
+}
+
+GitEventcPostReceiveRefFilter *
+git_eventc_post_receive_ref_filter_new(void)
+{
+    GitEventcPostReceiveRefFilter *self;
+
+    self = g_slice_new0(GitEventcPostReceiveRefFilter);
+    self->include = _git_eventc_post_receive_ref_patterns_new();
+    self->exclude = _git_eventc_post_receive_ref_patterns_new();
+
+    return self;
+}
+
+void
+git_eventc_post_receive_ref_filter_free(GitEventcPostReceiveRefFilter *self)
+{
+    if ( self == NULL )
+        return;
+
+    g_array_unref(self->exclude);
+    g_array_unref(self->include);
+
+    g_slice_free(GitEventcPostReceiveRefFilter, self);
+}
+
+void
+git_eventc_post_receive_ref_filter_add(GitEventcPostReceiveRefFilter *self, const gchar *string, gboolean exclude)
+{
+    GitEventcPostReceiveRefPattern pattern = {
+        .type = GIT_EVENTC_POST_RECEIVE_REF_PATTERN_EXACT,
+        .string = g_strdup(string),
+        .length = strlen(string),
+    };
+    gsize wildcard;
+
+    if ( pattern.length == 0 )
+    {
+        g_free(pattern.string);
+        return;
+    }
+
+    wildcard = strcspn(pattern.string, "*?");
+    if ( wildcard == pattern.length )
+        /* No wildcard, keep it exact */
+        ;
+    else if ( ( wildcard == pattern.length - 1 ) && ( pattern.string[wildcard] == '*' ) )
+    {
+        pattern.type = GIT_EVENTC_POST_RECEIVE_REF_PATTERN_PREFIX;
+        pattern.string[wildcard] = '\0';
+        pattern.length = wildcard;
+    }
+    else
+    {
+        pattern.type = GIT_EVENTC_POST_RECEIVE_REF_PATTERN_GLOB;
+        pattern.spec = g_pattern_spec_new(pattern.string);
+    }
+
+    g_array_append_val(exclude ? self->exclude : self->include, pattern);
+}
+
+gboolean
+git_eventc_post_receive_ref_filter_is_empty(const GitEventcPostReceiveRefFilter *self)
+{
+    return ( self->include->len == 0 ) && ( self->exclude->len == 0 );
+}
+
+static gboolean
+_git_eventc_post_receive_ref_patterns_match(GArray *patterns, const gchar *name)
+{
+    gsize length = strlen(name);
+    gboolean match = FALSE;
+    guint i;
+
+    for ( i = 0 ; ( ! match ) && ( i < patterns->len ) ; ++i )
+    {
+        GitEventcPostReceiveRefPattern *pattern = &g_array_index(patterns, GitEventcPostReceiveRefPattern, i);
+        switch ( pattern->type )
+        {
+        case GIT_EVENTC_POST_RECEIVE_REF_PATTERN_EXACT:
+            match = ( length == pattern->length ) && ( memcmp(name, pattern->string, length) == 0 );
+        break;
+        case GIT_EVENTC_POST_RECEIVE_REF_PATTERN_PREFIX:
+            match = ( length >= pattern->length ) && ( strncmp(name, pattern->string, pattern->length) == 0 );
+        break;
+        case GIT_EVENTC_POST_RECEIVE_REF_PATTERN_GLOB:
+            match = g_pattern_match_string(pattern->spec, name);
+        break;
+        }
+    }
+
+    return match;
+}
+
+gboolean
+git_eventc_post_receive_ref_filter_match(const GitEventcPostReceiveRefFilter *self, const gchar *name)
+{
+    if ( ( self->include->len > 0 ) && ( ! _git_eventc_post_receive_ref_patterns_match(self->include, name) ) )
+        return FALSE;
+    return ! _git_eventc_post_receive_ref_patterns_match(self->exclude, name);
+}
+
+/*
+ * Drop the lines of filtered out refs, in place
+ */
+gsize
+git_eventc_post_receive_ref_filter_input(const GitEventcPostReceiveRefFilter *self, gchar *input, gsize length)
+{
+    gchar *r, *w = input, *n, *name;
+    gsize l;
+
+    for ( r = input ; r < input + length ; r = n + 1 )
+    {
+        n = memchr(r, '\n', length - ( r - input ));
+        if ( n == NULL )
+            /* Incomplete line, the parser ignores it anyway */
+            break;
+        l = n - r + 1;
+
+        /* "<before> <after> <name>" */
+        name = memchr(r, ' ', l);
+        if ( name != NULL )
+            name = memchr(name + 1, ' ', n - name - 1);
+        if ( name != NULL )
+        {
+            gboolean keep;
+
+            *n = '\0';
+            keep = git_eventc_post_receive_ref_filter_match(self, name + 1);
+            *n = '\n';
+            if ( ! keep )
+                continue;
+        }
+
+        memmove(w, r, l);
+        w += l;
+    }
+
+    return w - input;
+}
@@ -0,0 +1,109 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <git2.h>
+#include <git2/sys/hashsig.h>
+
+#include "post-receive-similarity.h"
+
+/*
+ * Same as libgit2 default metric, with a deadline
+ */
+
+static gboolean
+_git_eventc_post_receive_similarity_check(GitEventcPostReceiveSimilarity *self)
+{
+    if ( ( self->deadline > 0 ) && ( g_get_monotonic_time() > self->deadline ) )
+        self->expired = TRUE;
+    return ! self->expired;
+}
+
+static int
+_git_eventc_post_receive_similarity_file_signature(void **out, const git_diff_file *file, const char *fullpath, void *payload)
+{
+    GitEventcPostReceiveSimilarity *self = payload;
+
+    if ( ! _git_eventc_post_receive_similarity_check(self) )
+        return GIT_EUSER;
+    return git_hashsig_create_fromfile((git_hashsig **) out, fullpath, self->options);
+}
+
+static int
+_git_eventc_post_receive_similarity_buffer_signature(void **out, const git_diff_file *file, const char *buf, size_t buflen, void *payload)
+{
+    GitEventcPostReceiveSimilarity *self = payload;
+
+    if ( ! _git_eventc_post_receive_similarity_check(self) )
+        return GIT_EUSER;
+    return git_hashsig_create((git_hashsig **) out, buf, buflen, self->options);
+}
+
+static void
+_git_eventc_post_receive_similarity_free_signature(void *sig, void *payload)
+{
+    git_hashsig_free(sig);
+}
+
+static int
+_git_eventc_post_receive_similarity_similarity(int *score, void *siga, void *sigb, void *payload)
+{
+    GitEventcPostReceiveSimilarity *self = payload;
+    int r;
+
+    if ( ! _git_eventc_post_receive_similarity_check(self) )
+        return GIT_EUSER;
+    r = git_hashsig_compare(siga, sigb);
+    if ( r < 0 )
+        return r;
+    *score = r;
+    return 0;
+}
+
+/*
+ * Whitespace handling follows the find flags, as libgit2 does,
+ * and small files are compared too rather than only matched exactly
+ */
+void
+git_eventc_post_receive_similarity_init(GitEventcPostReceiveSimilarity *self, guint32 find_flags, gint64 deadline)
+{
+    self->metric.file_signature = _git_eventc_post_receive_similarity_file_signature;
+    self->metric.buffer_signature = _git_eventc_post_receive_similarity_buffer_signature;
+    self->metric.free_signature = _git_eventc_post_receive_similarity_free_signature;
+    self->metric.similarity = _git_eventc_post_receive_similarity_similarity;
+    self->metric.payload = self;
+
+    if ( find_flags & GIT_DIFF_FIND_IGNORE_WHITESPACE )
+        self->options = GIT_HASHSIG_IGNORE_WHITESPACE;
+    else if ( find_flags & GIT_DIFF_FIND_DONT_IGNORE_WHITESPACE )
+        self->options = GIT_HASHSIG_NORMAL;
+    else
+        self->options = GIT_HASHSIG_SMART_WHITESPACE;
+    self->options |= GIT_HASHSIG_ALLOW_SMALL_FILES;
+
+    self->deadline = deadline;
+    self->expired = FALSE;
+}
@@ -0,0 +1,36 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef __GIT_EVENTC_POST_RECEIVE_SIMILARITY_H__
+#define __GIT_EVENTC_POST_RECEIVE_SIMILARITY_H__
+
+typedef struct {
+    git_diff_similarity_metric metric;
+    git_hashsig_option_t options;
+    gint64 deadline;
+    gboolean expired;
+} GitEventcPostReceiveSimilarity;
+
+void git_eventc_post_receive_similarity_init(GitEventcPostReceiveSimilarity *self, guint32 find_flags, gint64 deadline);
+
+#endif /* __GIT_EVENTC_POST_RECEIVE_SIMILARITY_H__ */
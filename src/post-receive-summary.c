@@ -0,0 +1,136 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <git2.h>
+
+#include "post-receive-summary.h"
+
+/*
+ * The commit-group summary parts that need neither a walk nor a diff
+ */
+
+static gint
+_git_eventc_post_receive_summary_authors_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    GHashTable *authors = user_data;
+    guint ca = GPOINTER_TO_UINT(g_hash_table_lookup(authors, a));
+    guint cb = GPOINTER_TO_UINT(g_hash_table_lookup(authors, b));
+
+    if ( ca != cb )
+        return ( ca > cb ) ? -1 : 1;
+    return g_utf8_collate(a, b);
+}
+
+/*
+ * Most active first, then by name
+ */
+void
+git_eventc_post_receive_summary_authors(GHashTable *authors, GVariant **names, GVariant **counts)
+{
+    GVariantBuilder names_builder, counts_builder;
+    GList *list, *author;
+
+    list = g_list_sort_with_data(g_hash_table_get_keys(authors), _git_eventc_post_receive_summary_authors_compare, authors);
+    g_variant_builder_init(&names_builder, G_VARIANT_TYPE_STRING_ARRAY);
+    g_variant_builder_init(&counts_builder, G_VARIANT_TYPE("au"));
+    for ( author = list ; author != NULL ; author = g_list_next(author) )
+    {
+        g_variant_builder_add(&names_builder, "s", author->data);
+        g_variant_builder_add(&counts_builder, "u", GPOINTER_TO_UINT(g_hash_table_lookup(authors, author->data)));
+    }
+    g_list_free(list);
+
+    *names = g_variant_builder_end(&names_builder);
+    *counts = g_variant_builder_end(&counts_builder);
+}
+
+static gint
+_git_eventc_post_receive_summary_tree_changes_compare(gconstpointer a, gconstpointer b)
+{
+    /* We get pointers to the elements */
+    return g_strcmp0(*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+static void
+_git_eventc_post_receive_summary_tree_changes_add(GPtrArray *changes, const git_tree_entry *entry)
+{
+    if ( git_tree_entry_type(entry) == GIT_OBJ_TREE )
+        g_ptr_array_add(changes, g_strdup_printf("%s/", git_tree_entry_name(entry)));
+    else
+        g_ptr_array_add(changes, g_strdup(git_tree_entry_name(entry)));
+}
+
+/*
+ * Top-level entries changed between the two tips
+ * Comparing the root trees entries is enough, we never recurse
+ */
+GVariant *
+git_eventc_post_receive_summary_top_level_changes(git_repository *repository, const git_oid *from_id, const git_oid *to_id)
+{
+    git_commit *from = NULL, *to = NULL;
+    git_tree *from_tree = NULL, *to_tree = NULL;
+    GPtrArray *changes;
+    GVariant *ret = NULL;
+    gsize i, l;
+
+    if ( ( git_commit_lookup(&from, repository, from_id) < 0 ) || ( git_commit_lookup(&to, repository, to_id) < 0 ) )
+        goto cleanup;
+    if ( ( git_commit_tree(&from_tree, from) < 0 ) || ( git_commit_tree(&to_tree, to) < 0 ) )
+        goto cleanup;
+
+    changes = g_ptr_array_new_with_free_func(g_free);
+    for ( i = 0, l = git_tree_entrycount(to_tree) ; i < l ; ++i )
+    {
+        const git_tree_entry *entry = git_tree_entry_byindex(to_tree, i);
+        const git_tree_entry *old = git_tree_entry_byname(from_tree, git_tree_entry_name(entry));
+        if ( ( old == NULL ) || ( git_tree_entry_filemode(old) != git_tree_entry_filemode(entry) ) || ( git_oid_cmp(git_tree_entry_id(old), git_tree_entry_id(entry)) != 0 ) )
+            _git_eventc_post_receive_summary_tree_changes_add(changes, entry);
+    }
+    for ( i = 0, l = git_tree_entrycount(from_tree) ; i < l ; ++i )
+    {
+        const git_tree_entry *entry = git_tree_entry_byindex(from_tree, i);
+        if ( git_tree_entry_byname(to_tree, git_tree_entry_name(entry)) == NULL )
+            _git_eventc_post_receive_summary_tree_changes_add(changes, entry);
+    }
+
+    g_ptr_array_sort(changes, _git_eventc_post_receive_summary_tree_changes_compare);
+    g_ptr_array_add(changes, NULL);
+    ret = g_variant_new_strv((const gchar * const *) changes->pdata, -1);
+    g_ptr_array_unref(changes);
+
+cleanup:
+    giterr_clear();
+    if ( to_tree != NULL )
+        git_tree_free(to_tree);
+    if ( from_tree != NULL )
+        git_tree_free(from_tree);
+    if ( to != NULL )
+        git_commit_free(to);
+    if ( from != NULL )
+        git_commit_free(from);
+    return ret;
+}
@@ -0,0 +1,30 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef __GIT_EVENTC_POST_RECEIVE_SUMMARY_H__
+#define __GIT_EVENTC_POST_RECEIVE_SUMMARY_H__
+
+void git_eventc_post_receive_summary_authors(GHashTable *authors, GVariant **names, GVariant **counts);
+GVariant *git_eventc_post_receive_summary_top_level_changes(git_repository *repository, const git_oid *from, const git_oid *to);
+
+#endif /* __GIT_EVENTC_POST_RECEIVE_SUMMARY_H__ */
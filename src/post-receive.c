@@ -25,22 +25,50 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glib-object.h>
 #include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#ifdef ENABLE_SYSTEMD
+#include <sys/socket.h>
+#include <systemd/sd-daemon.h>
+#endif /* ENABLE_SYSTEMD */
 
 #include <nkutils-format-string.h>
 
 #include <git2.h>
+#include <git2/sys/hashsig.h>
 
 #include "libgit-eventc.h"
+#include "post-receive-cache.h"
+#include "post-receive-ref-filter.h"
+#include "post-receive-similarity.h"
+#include "post-receive-summary.h"
+
+typedef struct _GitEventcPostReceivePool GitEventcPostReceivePool;
+
+typedef struct {
+    gint64 start;
+    gint64 config;
+    gint64 walk;
+    gint64 analysis;
+    gint64 analysis_wait;
+    gint64 similarity;
+    gint64 previous_tag;
+    gint64 connect;
+} GitEventcPostReceiveProfile;
 
 typedef struct {
     git_repository *repository;
+    GitEventcPostReceivePool *pool;
     const gchar *repository_name;
     gchar *repository_url;
+    gchar *repository_config_name;
     gchar *repository_guessed_name;
     const gchar *pusher;
     const gchar *project[2];
@@ -51,9 +79,88 @@ typedef struct {
     NkFormatString *tag_url;
     NkFormatString *diff_url;
     gboolean branch_creation_commits;
+    gboolean first_parent;
+    guint commit_count_limit;
     GVariant *extra_data;
+    GHashTable *tags;
+    GHashTable *commits;
+    GArray *path_projects;
+    gchar *hide_refs;
+    GArray *refs;
+    GArray *tips;
+    GitEventcPostReceiveProfile profile;
 } GitEventcPostReceiveContext;
 
+typedef struct {
+    gchar *name;
+    git_oid id;
+} GitEventcPostReceiveRefTip;
+
+typedef struct {
+    gchar *prefix;
+    gchar *project;
+    guint index;
+} GitEventcPostReceivePathProject;
+
+typedef struct {
+    gint ref_count;
+    git_oid id;
+    gboolean pooled;
+    gboolean done;
+    gchar *files;
+    gchar **path_projects_files;
+    gsize path_projects_length;
+    gboolean similarity_skipped;
+    gint64 similarity_time;
+    gint64 analysis_time;
+    gboolean profiled;
+    gboolean looked_up;
+    gchar *message;
+    gchar *author_name;
+    gchar *author_email;
+} GitEventcPostReceiveCommit;
+
+typedef struct {
+    const gchar *name;
+    const gchar *before;
+    const gchar *after;
+    git_oid from;
+    git_oid to;
+    gboolean hide_listed;
+    gboolean walked;
+    guint size;
+    gboolean approximate;
+    GPtrArray *commits;
+    GHashTable *authors;
+    git_oid newest;
+    git_oid oldest;
+} GitEventcPostReceiveRef;
+
+typedef struct {
+    const gchar *path;
+    const gchar *pusher;
+    const gchar *repository_name;
+    gchar *input;
+    gsize length;
+} GitEventcPostReceiveRequest;
+
+/*
+ * Threads are only started as commits are queued, up to the pool size,
+ * so small pushes do not pay for a whole pool.
+ * The pool lives as long as its repository (across pushes in daemon
+ * mode), so do the threads' repositories and their caches.
+ */
+struct _GitEventcPostReceivePool {
+    gchar *path;
+    const GArray *path_projects;
+    guint size;
+    GAsyncQueue *queue;
+    GPtrArray *threads;
+    GMutex mutex;
+    GCond cond;
+    guint pending;
+};
+
 typedef enum {
     GIT_EVENTC_POST_RECEIVE_TOKEN_PROJECT_GROUP,
     GIT_EVENTC_POST_RECEIVE_TOKEN_REPOSITORY_NAME,
@@ -86,6 +193,43 @@ static const gchar *_git_eventc_post_receive_format_tokens[] = {
 
 static git_diff_options _git_eventc_diff_options;
 static git_diff_find_options _git_eventc_diff_find_options;
+static guint32 _git_eventc_diff_find_flags = GIT_DIFF_FIND_RENAMES;
+static gboolean _git_eventc_branch_creation_commits = TRUE;
+static gboolean _git_eventc_first_parent = FALSE;
+static gboolean _git_eventc_profile = FALSE;
+static gboolean _git_eventc_profile_event = FALSE;
+static gint _git_eventc_commit_count_limit = 0;
+static gint _git_eventc_multi_ref_threshold = 0;
+static GitEventcPostReceiveCache *_git_eventc_files_cache = NULL;
+static gint _git_eventc_find_max_files = 1000;
+static gint _git_eventc_find_max_size = 64;
+static gint _git_eventc_find_timeout = 2000;
+static gint _git_eventc_jobs = 0;
+static gint _git_eventc_max_repositories = 16;
+static gint64 _git_eventc_hook_start = 0;
+
+static guint
+_git_eventc_oid_hash(gconstpointer key)
+{
+    const git_oid *id = key;
+    guint hash;
+
+    /* Object ids are already well distributed */
+    memcpy(&hash, id->id, sizeof(hash));
+    return hash;
+}
+
+static gboolean
+_git_eventc_oid_equal(gconstpointer a, gconstpointer b)
+{
+    return ( git_oid_equal(a, b) != 0 );
+}
+
+static void
+_git_eventc_oid_free(gpointer data)
+{
+    g_slice_free(git_oid, data);
+}
 
 static int
 _git_eventc_diff_foreach_callback(const git_diff_delta *delta, float progress, void *payload)
@@ -120,170 +264,884 @@ _git_eventc_diff_foreach_callback(const git_diff_delta *delta, float progress, v
     return 0;
 }
 
-static int
-_git_eventc_tree_walk_callback(const char *root, const git_tree_entry *entry, void *payload)
+/* Root commits: list that many top-level entries… */
+#define GIT_EVENTC_ROOT_SUMMARY_ENTRIES 16
+/* …and count the other files, up to that many, this deep */
+#define GIT_EVENTC_ROOT_SUMMARY_FILES 100000
+#define GIT_EVENTC_ROOT_SUMMARY_DEPTH 32
+
+static gboolean
+_git_eventc_tree_count_files(git_repository *repository, const git_tree *tree, guint depth, gsize *count)
 {
-    GList **paths = payload;
+    gsize i, l = git_tree_entrycount(tree);
+
+    for ( i = 0 ; i < l ; ++i )
+    {
+        const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+        git_tree *subtree;
 
-    *paths = g_list_prepend(*paths, g_strdup(git_tree_entry_name(entry)));
+        if ( *count >= GIT_EVENTC_ROOT_SUMMARY_FILES )
+            return FALSE;
 
-    return 0;
+        if ( git_tree_entry_type(entry) != GIT_OBJ_TREE )
+        {
+            ++*count;
+            continue;
+        }
+
+        if ( depth >= GIT_EVENTC_ROOT_SUMMARY_DEPTH )
+            return FALSE;
+        if ( git_tree_lookup(&subtree, repository, git_tree_entry_id(entry)) < 0 )
+            return FALSE;
+
+        gboolean complete;
+        complete = _git_eventc_tree_count_files(repository, subtree, depth + 1, count);
+        git_tree_free(subtree);
+        if ( ! complete )
+            return FALSE;
+    }
+
+    return TRUE;
 }
 
 static gchar *
-_git_eventc_commit_get_files(git_repository *repository, const git_commit *commit)
+_git_eventc_tree_summarize(git_repository *repository, const git_tree *tree)
+{
+    gsize i, l = git_tree_entrycount(tree);
+    gsize count = 0;
+    gboolean complete = TRUE;
+    GString *files;
+
+    if ( l == 0 )
+        return NULL;
+
+    files = g_string_new("");
+    for ( i = 0 ; i < l ; ++i )
+    {
+        const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+        gboolean is_tree = ( git_tree_entry_type(entry) == GIT_OBJ_TREE );
+
+        if ( i < GIT_EVENTC_ROOT_SUMMARY_ENTRIES )
+            g_string_append_printf(files, "%s%s ", git_tree_entry_name(entry), is_tree ? "/" : "");
+        else if ( ! is_tree )
+            ++count;
+
+        if ( ( ! is_tree ) || ( ! complete ) )
+            continue;
+
+        git_tree *subtree;
+        if ( git_tree_lookup(&subtree, repository, git_tree_entry_id(entry)) < 0 )
+        {
+            complete = FALSE;
+            continue;
+        }
+        complete = _git_eventc_tree_count_files(repository, subtree, 1, &count);
+        git_tree_free(subtree);
+    }
+
+    if ( count > 0 )
+        g_string_append_printf(files, "+%" G_GSIZE_FORMAT "%s files ", count, complete ? "" : "…");
+
+    g_string_truncate(files, files->len - 1);
+    return g_string_free(files, FALSE);
+}
+
+static gboolean
+_git_eventc_diff_find_within_budget(git_repository *repository, git_diff *diff)
+{
+    gboolean copies = ( ( _git_eventc_diff_find_flags & GIT_DIFF_FIND_COPIES ) != 0 );
+    gsize max_size = (gsize) _git_eventc_find_max_size << 20;
+    gsize i, l = git_diff_num_deltas(diff);
+    gsize files = 0, size = 0;
+    git_odb *odb = NULL;
+    gboolean ret = FALSE;
+
+    if ( ( _git_eventc_find_max_size > 0 ) && ( git_repository_odb(&odb, repository) < 0 ) )
+        return FALSE;
+
+    for ( i = 0 ; i < l ; ++i )
+    {
+        const git_diff_delta *delta = git_diff_get_delta(diff, i);
+        const git_diff_file *file;
+
+        /* Submodule commits are not in our odb, and never paired anyway */
+        if ( ( delta->old_file.mode == GIT_FILEMODE_COMMIT ) || ( delta->new_file.mode == GIT_FILEMODE_COMMIT ) )
+            continue;
+
+        switch ( delta->status )
+        {
+        case GIT_DELTA_ADDED:
+            file = &delta->new_file;
+        break;
+        case GIT_DELTA_DELETED:
+            file = &delta->old_file;
+        break;
+        case GIT_DELTA_MODIFIED:
+            if ( copies )
+            {
+                file = &delta->old_file;
+                break;
+            }
+            /* fallthrough */
+        default:
+            continue;
+        }
+
+        if ( ( _git_eventc_find_max_files > 0 ) && ( ++files > (gsize) _git_eventc_find_max_files ) )
+            goto out;
+
+        if ( odb == NULL )
+            continue;
+
+        /* Only the header, we do not want to inflate blobs here */
+        size_t blob_size;
+        git_otype type;
+        if ( git_odb_read_header(&blob_size, &type, odb, &file->id) < 0 )
+            goto out;
+        size += blob_size;
+        if ( size > max_size )
+            goto out;
+    }
+    ret = TRUE;
+
+out:
+    if ( odb != NULL )
+        git_odb_free(odb);
+    giterr_clear();
+    return ret;
+}
+
+static int
+_git_eventc_diff_find_similar(git_repository *repository, git_diff *diff, gboolean *skipped)
+{
+    int error;
+
+    if ( ! _git_eventc_diff_find_within_budget(repository, diff) )
+    {
+        *skipped = TRUE;
+        return 0;
+    }
+
+    GitEventcPostReceiveSimilarity similarity;
+    git_diff_find_options options = _git_eventc_diff_find_options;
+    options.flags = _git_eventc_diff_find_flags;
+    git_eventc_post_receive_similarity_init(&similarity, options.flags, ( _git_eventc_find_timeout > 0 ) ? ( g_get_monotonic_time() + (gint64) _git_eventc_find_timeout * G_TIME_SPAN_MILLISECOND ) : 0);
+    options.metric = &similarity.metric;
+
+    error = git_diff_find_similar(diff, &options);
+    if ( similarity.expired )
+    {
+        giterr_clear();
+        *skipped = TRUE;
+        return GIT_EUSER;
+    }
+    return error;
+}
+
+/*
+ * Diff a commit against its first parent, or get its tree for root commits
+ */
+static int
+_git_eventc_commit_diff(git_repository *repository, const git_commit *commit, const git_diff_options *options, git_diff **diff, git_tree **tree, gboolean *similarity_skipped, gint64 *similarity_time)
 {
     int error = 0;
-    gchar *files = NULL;
     git_commit *parent_commit = NULL;
-    git_tree *tree = NULL, *parent_tree = NULL;
-    GList *paths = NULL;
+    git_tree *parent_tree = NULL;
+
+    *diff = NULL;
+    *tree = NULL;
 
-    error = git_commit_tree(&tree, commit);
+    error = git_commit_tree(tree, commit);
     if ( error < 0 )
     {
         g_warning("Couldn't get commit tree: %s", giterr_last()->message);
         goto fail;
     }
 
-    if ( git_commit_parentcount(commit) > 0 )
+    if ( git_commit_parentcount(commit) == 0 )
+        return 0;
+
+    error = git_commit_parent(&parent_commit, commit, 0);
+    if ( error < 0 )
     {
-        error = git_commit_parent(&parent_commit, commit, 0);
-        if ( error < 0 )
-        {
-            g_warning("Couldn't parent commit: %s", giterr_last()->message);
-            goto fail;
-        }
-        error = git_commit_tree(&parent_tree, parent_commit);
-        if ( error < 0 )
-        {
-            g_warning("Couldn't parent commit tree: %s", giterr_last()->message);
-            goto fail;
-        }
+        g_warning("Couldn't parent commit: %s", giterr_last()->message);
+        goto fail;
+    }
+    error = git_commit_tree(&parent_tree, parent_commit);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't parent commit tree: %s", giterr_last()->message);
+        goto fail;
+    }
+
+    error = git_diff_tree_to_tree(diff, repository, parent_tree, *tree, options);
+    if ( error < 0 )
+    {
+        *diff = NULL;
+        g_warning("Couldn't get the diff: %s", giterr_last()->message);
+        goto fail;
+    }
 
-        git_diff *diff;
-        error = git_diff_tree_to_tree(&diff, repository, parent_tree, tree, &_git_eventc_diff_options);
+    /* No need to load any blob if we do not look for renames or copies */
+    if ( _git_eventc_diff_find_flags & ( GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_COPIES ) )
+    {
+        gint64 start = g_get_monotonic_time();
+        error = _git_eventc_diff_find_similar(repository, *diff, similarity_skipped);
+        *similarity_time = g_get_monotonic_time() - start;
+    }
+    if ( ( error < 0 ) && *similarity_skipped )
+    {
+        /* Aborted mid-way, start over with a plain diff */
+        git_diff_free(*diff);
+        error = git_diff_tree_to_tree(diff, repository, parent_tree, *tree, options);
         if ( error < 0 )
         {
+            *diff = NULL;
             g_warning("Couldn't get the diff: %s", giterr_last()->message);
             goto fail;
         }
-        error = git_diff_find_similar(diff, &_git_eventc_diff_find_options);
-        if ( error < 0 )
-        {
-            g_warning("Couldn't find similar files: %s", giterr_last()->message);
-            goto fail;
-        }
-
-        git_diff_foreach(diff, _git_eventc_diff_foreach_callback, NULL, NULL, NULL, &paths);
     }
-    else
-        git_tree_walk(tree, GIT_TREEWALK_PRE, _git_eventc_tree_walk_callback, &paths);
-
-    files = git_eventc_get_files(paths);
+    else if ( error < 0 )
+    {
+        g_warning("Couldn't find similar files: %s", giterr_last()->message);
+        goto fail;
+    }
 
 fail:
     if ( parent_tree != NULL )
         git_tree_free(parent_tree);
-    if ( tree != NULL )
-        git_tree_free(tree);
     if ( parent_commit != NULL )
         git_commit_free(parent_commit);
-    return files;
+    if ( error < 0 )
+    {
+        if ( *diff != NULL )
+            git_diff_free(*diff);
+        if ( *tree != NULL )
+            git_tree_free(*tree);
+        *diff = NULL;
+        *tree = NULL;
+    }
+    return error;
 }
 
-static gchar *
-_git_eventc_post_receive_get_config_string(git_config *config, const gchar *name)
+/*
+ * files is NULL for an empty commit, only a FALSE return means we failed
+ */
+static gboolean
+_git_eventc_commit_get_files(git_repository *repository, const git_commit *commit, gchar **files, gboolean *similarity_skipped, gint64 *similarity_time)
 {
-    git_config_entry *entry;
-    if ( git_config_get_entry(&entry, config, name) < 0 )
-        return NULL;
+    git_tree *tree;
+    git_diff *diff;
+    GList *paths = NULL;
 
-    gchar *value;
+    *files = NULL;
+    if ( _git_eventc_commit_diff(repository, commit, &_git_eventc_diff_options, &diff, &tree, similarity_skipped, similarity_time) < 0 )
+        return FALSE;
 
-    value = g_strdup(entry->value);
+    if ( diff != NULL )
+    {
+        int error = git_diff_foreach(diff, _git_eventc_diff_foreach_callback, NULL, NULL, NULL, &paths);
+        *files = git_eventc_get_files(paths);
+        git_diff_free(diff);
+        if ( error < 0 )
+        {
+            g_warning("Couldn't list the diff files: %s", giterr_last()->message);
+            giterr_clear();
+            git_tree_free(tree);
+            return FALSE;
+        }
+    }
+    else
+        /* Initial imports can be huge, never list the whole tree */
+        *files = _git_eventc_tree_summarize(repository, tree);
 
-    git_config_entry_free(entry);
-    return value;
+    git_tree_free(tree);
+    return TRUE;
 }
 
-static NkFormatString *
-_git_eventc_post_receive_get_config_url_format(git_config *config, const gchar *name, GitEventcPostReceiveFormatFlags tokens)
+typedef struct {
+    const GArray *path_projects;
+    GList **paths;
+} GitEventcPathProjectsDiffData;
+
+static gchar *
+_git_eventc_string_take_printf(gchar *old, const gchar *format, ...)
 {
-    gchar *string;
+    va_list args;
+    gchar *ret;
 
-    string = _git_eventc_post_receive_get_config_string(config, name);
-    if ( string == NULL )
-        return NULL;
+    va_start(args, format);
+    ret = g_strdup_vprintf(format, args);
+    va_end(args);
+    g_free(old);
 
-    NkFormatString *value;
-    guint64 used_tokens;
-    GError *error = NULL;
-    value = nk_format_string_parse_enum(string, '$', _git_eventc_post_receive_format_tokens, G_N_ELEMENTS(_git_eventc_post_receive_format_tokens), &used_tokens, &error);
-    if ( value == NULL )
+    return ret;
+}
+
+static gboolean
+_git_eventc_path_has_prefix(const gchar *path, const gchar *prefix)
+{
+    gsize l = strlen(prefix);
+    return ( strncmp(path, prefix, l) == 0 ) && ( ( path[l] == '\0' ) || ( path[l] == '/' ) );
+}
+
+static int
+_git_eventc_path_projects_diff_foreach_callback(const git_diff_delta *delta, float progress, void *payload)
+{
+    GitEventcPathProjectsDiffData *data = payload;
+    const gchar *path = ( delta->status == GIT_DELTA_DELETED ) ? delta->old_file.path : delta->new_file.path;
+    gboolean added[data->path_projects->len];
+    guint i;
+
+    memset(added, 0, sizeof(added));
+    for ( i = 0 ; i < data->path_projects->len ; ++i )
     {
-        g_warning("Could not parse URL template: %s", error->message);
-        g_clear_error(&error);
-        return NULL;
+        const GitEventcPostReceivePathProject *path_project = &g_array_index(data->path_projects, GitEventcPostReceivePathProject, i);
+        if ( added[path_project->index] )
+            continue;
+        if ( _git_eventc_path_has_prefix(path, path_project->prefix) || ( ( delta->status != GIT_DELTA_ADDED ) && _git_eventc_path_has_prefix(delta->old_file.path, path_project->prefix) ) )
+        {
+            /* Per project, not per prefix */
+            _git_eventc_diff_foreach_callback(delta, progress, &data->paths[path_project->index]);
+            added[path_project->index] = TRUE;
+        }
     }
 
-    if ( ( used_tokens & tokens ) == used_tokens )
-        return value;
-
-    g_warning("Found unexpected tokens in URL template %s", name);
-    nk_format_string_unref(value);
-    return NULL;
+    return 0;
 }
 
-static GVariant *
-_git_eventc_post_receive_get_config_hash_table(git_config *config, const gchar *prefix)
+/*
+ * Files list for each configured path prefix, NULL if not touched
+ */
+static gchar **
+_git_eventc_commit_get_path_projects_files(git_repository *repository, const git_commit *commit, const GArray *path_projects, gboolean *similarity_skipped, gint64 *similarity_time)
 {
-    gchar *name;
-    gsize l = strlen(prefix) + 1;
-    name = g_newa(gchar, l + 2);
-    g_snprintf(name, l + 2, "%s.*", prefix);
+    git_diff_options options = _git_eventc_diff_options;
+    gchar *pathspec[path_projects->len];
+    GList *paths[path_projects->len];
+    gchar **files;
+    git_tree *tree;
+    git_diff *diff;
+    guint i;
+
+    /* Only diff the interesting paths */
+    for ( i = 0 ; i < path_projects->len ; ++i )
+    {
+        pathspec[i] = g_array_index(path_projects, GitEventcPostReceivePathProject, i).prefix;
+        paths[i] = NULL;
+    }
+    options.pathspec.strings = pathspec;
+    options.pathspec.count = path_projects->len;
+    options.flags |= GIT_DIFF_DISABLE_PATHSPEC_MATCH;
 
-    git_config_iterator *iter;
-    git_config_entry *entry;
-    if ( git_config_iterator_glob_new(&iter, config, name) < 0 )
+    if ( _git_eventc_commit_diff(repository, commit, &options, &diff, &tree, similarity_skipped, similarity_time) < 0 )
         return NULL;
 
-    GVariantBuilder builder;
-    GError *error = NULL;
-    int r;
-    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
-    while ( ( r = git_config_next(&entry, iter) ) == 0 )
+    files = g_new0(gchar *, path_projects->len + 1);
+    if ( diff != NULL )
     {
-        GVariant *value;
-        value = g_variant_parse(NULL, entry->value, NULL, NULL, &error);
-        if ( value == NULL )
+        GitEventcPathProjectsDiffData data = {
+            .path_projects = path_projects,
+            .paths = paths,
+        };
+        git_diff_foreach(diff, _git_eventc_path_projects_diff_foreach_callback, NULL, NULL, NULL, &data);
+        for ( i = 0 ; i < path_projects->len ; ++i )
+            files[i] = git_eventc_get_files(paths[i]);
+        git_diff_free(diff);
+    }
+    else for ( i = 0 ; i < path_projects->len ; ++i )
+    {
+        guint index = g_array_index(path_projects, GitEventcPostReceivePathProject, i).index;
+        git_tree_entry *entry;
+        git_tree *subtree;
+        gchar *summary;
+
+        if ( git_tree_entry_bypath(&entry, tree, pathspec[i]) < 0 )
+            continue;
+
+        if ( ( git_tree_entry_type(entry) == GIT_OBJ_TREE ) && ( git_tree_lookup(&subtree, repository, git_tree_entry_id(entry)) == 0 ) )
         {
-            g_warning("Could not parse extra data '%s'='%s': %s", entry->name + l, entry->value, error->message);
-            break;
+            summary = _git_eventc_tree_summarize(repository, subtree);
+            if ( summary != NULL )
+                summary = _git_eventc_string_take_printf(summary, "%s/ %s", pathspec[i], summary);
+            git_tree_free(subtree);
+        }
+        else
+            summary = g_strdup(pathspec[i]);
+        git_tree_entry_free(entry);
+
+        if ( summary == NULL )
+            continue;
+        if ( files[index] == NULL )
+            files[index] = summary;
+        else
+        {
+            files[index] = _git_eventc_string_take_printf(files[index], "%s %s", files[index], summary);
+            g_free(summary);
         }
-        g_variant_builder_add(&builder, "{sv}", entry->name + l, value);
     }
-    git_config_iterator_free(iter);
-    if ( error != NULL )
-        g_clear_error(&error);
-    else if ( r != GIT_ITEROVER )
-        g_warning("Could not get extra data: %s", giterr_last()->message);
-    else
-        return g_variant_builder_end(&builder);
-    g_variant_builder_clear(&builder);
-    return NULL;
+    giterr_clear();
+
+    git_tree_free(tree);
+    return files;
 }
 
-typedef struct {
-    GitEventcPostReceiveContext *context;
-    const gchar *branch;
-    const gchar *commit;
-    const gchar *tag;
-    const gchar *old_commit;
-    const gchar *new_commit;
-} GitEventcPostReceiveFormatData;
+static GitEventcPostReceiveCommit *
+_git_eventc_post_receive_commit_new(const git_oid *id)
+{
+    GitEventcPostReceiveCommit *self;
 
-static GVariant *
+    self = g_slice_new0(GitEventcPostReceiveCommit);
+    self->ref_count = 1;
+    git_oid_cpy(&self->id, id);
+
+    return self;
+}
+
+static GitEventcPostReceiveCommit *
+_git_eventc_post_receive_commit_ref(GitEventcPostReceiveCommit *self)
+{
+    g_atomic_int_inc(&self->ref_count);
+    return self;
+}
+
+static void
+_git_eventc_post_receive_commit_unref(gpointer data)
+{
+    GitEventcPostReceiveCommit *self = data;
+
+    if ( ! g_atomic_int_dec_and_test(&self->ref_count) )
+        return;
+
+    g_free(self->author_email);
+    g_free(self->author_name);
+    g_free(self->message);
+    g_free(self->files);
+    if ( self->path_projects_files != NULL )
+    {
+        /* Sparse array, cannot use g_strfreev() */
+        gsize i;
+        for ( i = 0 ; i < self->path_projects_length ; ++i )
+            g_free(self->path_projects_files[i]);
+        g_free(self->path_projects_files);
+    }
+
+    g_slice_free(GitEventcPostReceiveCommit, self);
+}
+
+static void
+_git_eventc_post_receive_commit_analyse(git_repository *repository, const GArray *path_projects, GitEventcPostReceiveCommit *self)
+{
+    int error;
+    git_commit *commit;
+    guint32 flags;
+    guint32 find_flags = 0;
+    gint64 start = g_get_monotonic_time();
+
+    /* diff.renames may differ between repositories sharing the cache */
+    if ( _git_eventc_diff_find_flags & GIT_DIFF_FIND_RENAMES )
+        find_flags |= GIT_EVENTC_POST_RECEIVE_CACHE_FIND_RENAMES;
+    if ( _git_eventc_diff_find_flags & GIT_DIFF_FIND_COPIES )
+        find_flags |= GIT_EVENTC_POST_RECEIVE_CACHE_FIND_COPIES;
+
+    /* Routed commits are not cached, their result depend on the repository configuration */
+    if ( ( path_projects == NULL ) && ( _git_eventc_files_cache != NULL ) && git_eventc_post_receive_cache_lookup(_git_eventc_files_cache, &self->id, &self->files, &flags) )
+    {
+        if ( ( flags & GIT_EVENTC_POST_RECEIVE_CACHE_FIND_MASK ) == find_flags )
+        {
+            self->similarity_skipped = ( ( flags & GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED ) != 0 );
+            goto out;
+        }
+        g_free(self->files);
+        self->files = NULL;
+    }
+
+    error = git_commit_lookup(&commit, repository, &self->id);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't find commit: %s", giterr_last()->message);
+        goto out;
+    }
+
+    if ( path_projects != NULL )
+    {
+        self->path_projects_files = _git_eventc_commit_get_path_projects_files(repository, commit, path_projects, &self->similarity_skipped, &self->similarity_time);
+        self->path_projects_length = path_projects->len;
+        git_commit_free(commit);
+        goto out;
+    }
+
+    gboolean analysed = _git_eventc_commit_get_files(repository, commit, &self->files, &self->similarity_skipped, &self->similarity_time);
+    git_commit_free(commit);
+
+    /* A failure may be transient, do not make it stick for every other hook */
+    flags = find_flags | ( self->similarity_skipped ? GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED : 0 );
+    if ( analysed && ( _git_eventc_files_cache != NULL ) )
+        git_eventc_post_receive_cache_store(_git_eventc_files_cache, &self->id, self->files, flags);
+
+out:
+    /* Whichever thread we run in */
+    self->analysis_time = g_get_monotonic_time() - start;
+}
+
+static gpointer
+_git_eventc_post_receive_pool_thread(gpointer user_data)
+{
+    GitEventcPostReceivePool *pool = user_data;
+    git_repository *repository = NULL;
+    GitEventcPostReceiveCommit *commit;
+    int error;
+
+    /* libgit2 objects cannot be shared between threads */
+    error = git_repository_open(&repository, pool->path);
+    if ( error < 0 )
+        g_warning("Couldn't open repository: %s", giterr_last()->message);
+
+    /* The pool itself is our stop marker */
+    while ( ( commit = g_async_queue_pop(pool->queue) ) != (gpointer) pool )
+    {
+        /* The commit is ours until we mark it done */
+        if ( repository != NULL )
+            _git_eventc_post_receive_commit_analyse(repository, pool->path_projects, commit);
+
+        g_mutex_lock(&pool->mutex);
+        commit->done = TRUE;
+        --pool->pending;
+        g_cond_broadcast(&pool->cond);
+        g_mutex_unlock(&pool->mutex);
+
+        _git_eventc_post_receive_commit_unref(commit);
+    }
+
+    if ( repository != NULL )
+        git_repository_free(repository);
+    giterr_clear();
+
+    return NULL;
+}
+
+static GitEventcPostReceivePool *
+_git_eventc_post_receive_pool_new(const gchar *path, const GArray *path_projects, guint size)
+{
+    GitEventcPostReceivePool *pool;
+
+    pool = g_slice_new0(GitEventcPostReceivePool);
+    pool->path = g_strdup(path);
+    pool->path_projects = path_projects;
+    pool->size = size;
+    pool->queue = g_async_queue_new();
+    pool->threads = g_ptr_array_new();
+    g_mutex_init(&pool->mutex);
+    g_cond_init(&pool->cond);
+
+    return pool;
+}
+
+static gboolean
+_git_eventc_post_receive_pool_push(GitEventcPostReceivePool *pool, GitEventcPostReceiveCommit *commit)
+{
+    gboolean start;
+
+    g_mutex_lock(&pool->mutex);
+    start = ( pool->pending >= pool->threads->len ) && ( pool->threads->len < pool->size );
+    g_mutex_unlock(&pool->mutex);
+
+    if ( start )
+    {
+        GThread *thread;
+        GError *error = NULL;
+
+        thread = g_thread_try_new("git-eventc-analysis", _git_eventc_post_receive_pool_thread, pool, &error);
+        if ( thread == NULL )
+        {
+            g_warning("Couldn't start analysis thread: %s", error->message);
+            g_clear_error(&error);
+        }
+        else
+            g_ptr_array_add(pool->threads, thread);
+    }
+
+    if ( pool->threads->len == 0 )
+        /* Analysed inline then */
+        return FALSE;
+
+    g_mutex_lock(&pool->mutex);
+    ++pool->pending;
+    g_mutex_unlock(&pool->mutex);
+    g_async_queue_push(pool->queue, _git_eventc_post_receive_commit_ref(commit));
+
+    return TRUE;
+}
+
+/*
+ * Threads may still be on commits we never waited for,
+ * and they must be done with this push path projects
+ */
+static void
+_git_eventc_post_receive_pool_wait(GitEventcPostReceivePool *pool)
+{
+    g_mutex_lock(&pool->mutex);
+    while ( pool->pending > 0 )
+        g_cond_wait(&pool->cond, &pool->mutex);
+    g_mutex_unlock(&pool->mutex);
+}
+
+static void
+_git_eventc_post_receive_pool_free(GitEventcPostReceivePool *pool)
+{
+    guint i;
+
+    for ( i = 0 ; i < pool->threads->len ; ++i )
+        g_async_queue_push(pool->queue, pool);
+    for ( i = 0 ; i < pool->threads->len ; ++i )
+        g_thread_join(g_ptr_array_index(pool->threads, i));
+    g_ptr_array_unref(pool->threads);
+
+    g_cond_clear(&pool->cond);
+    g_mutex_clear(&pool->mutex);
+    g_async_queue_unref(pool->queue);
+    g_free(pool->path);
+
+    g_slice_free(GitEventcPostReceivePool, pool);
+}
+
+/* How often long operations let the eventd connection progress */
+#define GIT_EVENTC_POST_RECEIVE_POLL_INTERVAL (10 * G_TIME_SPAN_MILLISECOND)
+#define GIT_EVENTC_POST_RECEIVE_POLL_COMMITS 256
+
+static GitEventcPostReceiveCommit *
+_git_eventc_post_receive_commit_queue(GitEventcPostReceiveContext *context, const git_oid *id)
+{
+    GitEventcPostReceiveCommit *commit;
+
+    /* Refs sharing commits only get them analysed once */
+    if ( context->commits == NULL )
+        context->commits = g_hash_table_new_full(_git_eventc_oid_hash, _git_eventc_oid_equal, NULL, _git_eventc_post_receive_commit_unref);
+    else if ( ( commit = g_hash_table_lookup(context->commits, id) ) != NULL )
+        return _git_eventc_post_receive_commit_ref(commit);
+
+    commit = _git_eventc_post_receive_commit_new(id);
+    g_hash_table_insert(context->commits, &commit->id, _git_eventc_post_receive_commit_ref(commit));
+    if ( ( context->pool == NULL ) && ( _git_eventc_jobs > 1 ) )
+        context->pool = _git_eventc_post_receive_pool_new(git_repository_path(context->repository), context->path_projects, _git_eventc_jobs);
+    if ( context->pool != NULL )
+        commit->pooled = _git_eventc_post_receive_pool_push(context->pool, commit);
+
+    return commit;
+}
+
+static const gchar *
+_git_eventc_post_receive_commit_get_files(GitEventcPostReceiveContext *context, GitEventcPostReceiveCommit *commit)
+{
+    if ( ! commit->pooled )
+    {
+        if ( ! commit->done )
+        {
+            _git_eventc_post_receive_commit_analyse(context->repository, context->path_projects, commit);
+            commit->done = TRUE;
+            git_eventc_poll();
+        }
+        return commit->files;
+    }
+
+    g_mutex_lock(&context->pool->mutex);
+    while ( ! commit->done )
+    {
+        /* Keep the eventd connection going while we wait */
+        if ( g_cond_wait_until(&context->pool->cond, &context->pool->mutex, g_get_monotonic_time() + GIT_EVENTC_POST_RECEIVE_POLL_INTERVAL) )
+            continue;
+        g_mutex_unlock(&context->pool->mutex);
+        git_eventc_poll();
+        g_mutex_lock(&context->pool->mutex);
+    }
+    g_mutex_unlock(&context->pool->mutex);
+
+    return commit->files;
+}
+
+static gboolean
+_git_eventc_post_receive_commit_lookup(GitEventcPostReceiveContext *context, GitEventcPostReceiveCommit *commit)
+{
+    int error;
+    git_commit *commit_;
+
+    if ( commit->looked_up )
+        return TRUE;
+
+    error = git_commit_lookup(&commit_, context->repository, &commit->id);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't find commit: %s", giterr_last()->message);
+        return FALSE;
+    }
+
+    const git_signature *author = git_commit_author(commit_);
+    commit->message = g_strdup(git_commit_message(commit_));
+    commit->author_name = g_strdup(author->name);
+    commit->author_email = g_strdup(author->email);
+    commit->looked_up = TRUE;
+
+    git_commit_free(commit_);
+
+    return TRUE;
+}
+
+static gchar *
+_git_eventc_post_receive_get_config_string(git_config *config, const gchar *name)
+{
+    git_config_entry *entry;
+    if ( git_config_get_entry(&entry, config, name) < 0 )
+        return NULL;
+
+    gchar *value;
+
+    value = g_strdup(entry->value);
+
+    git_config_entry_free(entry);
+    return value;
+}
+
+static NkFormatString *
+_git_eventc_post_receive_get_config_url_format(git_config *config, const gchar *name, GitEventcPostReceiveFormatFlags tokens)
+{
+    gchar *string;
+
+    string = _git_eventc_post_receive_get_config_string(config, name);
+    if ( string == NULL )
+        return NULL;
+
+    NkFormatString *value;
+    guint64 used_tokens;
+    GError *error = NULL;
+    value = nk_format_string_parse_enum(string, '$', _git_eventc_post_receive_format_tokens, G_N_ELEMENTS(_git_eventc_post_receive_format_tokens), &used_tokens, &error);
+    if ( value == NULL )
+    {
+        g_warning("Could not parse URL template: %s", error->message);
+        g_clear_error(&error);
+        return NULL;
+    }
+
+    if ( ( used_tokens & tokens ) == used_tokens )
+        return value;
+
+    g_warning("Found unexpected tokens in URL template %s", name);
+    nk_format_string_unref(value);
+    return NULL;
+}
+
+static GVariant *
+_git_eventc_post_receive_get_config_hash_table(git_config *config, const gchar *prefix)
+{
+    gchar *name;
+    gsize l = strlen(prefix) + 1;
+    name = g_newa(gchar, l + 2);
+    g_snprintf(name, l + 2, "%s.*", prefix);
+
+    git_config_iterator *iter;
+    git_config_entry *entry;
+    if ( git_config_iterator_glob_new(&iter, config, name) < 0 )
+        return NULL;
+
+    GVariantBuilder builder;
+    GError *error = NULL;
+    int r;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    while ( ( r = git_config_next(&entry, iter) ) == 0 )
+    {
+        GVariant *value;
+        value = g_variant_parse(NULL, entry->value, NULL, NULL, &error);
+        if ( value == NULL )
+        {
+            g_warning("Could not parse extra data '%s'='%s': %s", entry->name + l, entry->value, error->message);
+            break;
+        }
+        g_variant_builder_add(&builder, "{sv}", entry->name + l, value);
+    }
+    git_config_iterator_free(iter);
+    if ( error != NULL )
+        g_clear_error(&error);
+    else if ( r != GIT_ITEROVER )
+        g_warning("Could not get extra data: %s", giterr_last()->message);
+    else
+        return g_variant_builder_end(&builder);
+    g_variant_builder_clear(&builder);
+    return NULL;
+}
+
+static void
+_git_eventc_post_receive_path_project_clear(gpointer data)
+{
+    GitEventcPostReceivePathProject *path_project = data;
+
+    g_free(path_project->project);
+    g_free(path_project->prefix);
+}
+
+static GArray *
+_git_eventc_post_receive_get_config_path_projects(git_config *config, const gchar *prefix)
+{
+    gchar *name;
+    gsize l = strlen(prefix) + 1;
+    name = g_newa(gchar, l + 2);
+    g_snprintf(name, l + 2, "%s.*", prefix);
+
+    git_config_iterator *iter;
+    git_config_entry *entry;
+    if ( git_config_iterator_glob_new(&iter, config, name) < 0 )
+        return NULL;
+
+    GArray *path_projects;
+    int r;
+    path_projects = g_array_new(FALSE, FALSE, sizeof(GitEventcPostReceivePathProject));
+    g_array_set_clear_func(path_projects, _git_eventc_post_receive_path_project_clear);
+    while ( ( r = git_config_next(&entry, iter) ) == 0 )
+    {
+        GitEventcPostReceivePathProject path_project;
+        gsize pl = strlen(entry->value);
+        guint i;
+
+        while ( ( pl > 0 ) && ( entry->value[pl - 1] == '/' ) )
+            --pl;
+        if ( pl == 0 )
+        {
+            g_warning("Empty path for project '%s'", entry->name + l);
+            continue;
+        }
+
+        path_project.prefix = g_strndup(entry->value, pl);
+        path_project.project = g_strdup(entry->name + l);
+
+        /* Several prefixes can route to the same project, they share a slot */
+        path_project.index = path_projects->len;
+        for ( i = 0 ; i < path_projects->len ; ++i )
+        {
+            if ( g_strcmp0(g_array_index(path_projects, GitEventcPostReceivePathProject, i).project, path_project.project) == 0 )
+            {
+                path_project.index = g_array_index(path_projects, GitEventcPostReceivePathProject, i).index;
+                break;
+            }
+        }
+        g_array_append_val(path_projects, path_project);
+    }
+    git_config_iterator_free(iter);
+    if ( r != GIT_ITEROVER )
+        g_warning("Could not get path projects: %s", giterr_last()->message);
+    else if ( path_projects->len > 0 )
+        return path_projects;
+    g_array_unref(path_projects);
+    return NULL;
+}
+
+typedef struct {
+    GitEventcPostReceiveContext *context;
+    const gchar *branch;
+    const gchar *commit;
+    const gchar *tag;
+    const gchar *old_commit;
+    const gchar *new_commit;
+} GitEventcPostReceiveFormatData;
+
+static GVariant *
 _git_eventc_post_receive_url_format_replace(const gchar *token, guint64 value, gpointer user_data)
 {
     GitEventcPostReceiveFormatData *data = user_data;
@@ -316,441 +1174,1650 @@ _git_eventc_post_receive_url_format_replace(const gchar *token, guint64 value, g
     return ( str == NULL ) ? NULL : g_variant_new_string(str);
 }
 
-static void
-_git_eventc_post_receive_init(GitEventcPostReceiveContext *context, gboolean branch_creation_commits)
+static gboolean
+_git_eventc_post_receive_get_config_size(git_config *config, const gchar *name, gsize *value)
+{
+    int64_t v;
+    if ( git_config_get_int64(&v, config, name) < 0 )
+    {
+        giterr_clear();
+        return FALSE;
+    }
+    if ( v < 0 )
+    {
+        g_warning("Wrong value for %s: %" G_GINT64_FORMAT, name, (gint64) v);
+        return FALSE;
+    }
+
+    *value = v;
+    return TRUE;
+}
+
+/*
+ * Without --find-renames or --find-copies, we follow diff.renames
+ * the way libgit2 does with GIT_DIFF_FIND_BY_CONFIG
+ */
+static void
+_git_eventc_post_receive_set_find_flags(git_config *config)
+{
+    gchar *renames;
+    int value;
+
+    _git_eventc_diff_find_flags = _git_eventc_diff_find_options.flags;
+    if ( _git_eventc_diff_find_flags & ( GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_COPIES ) )
+        return;
+
+    renames = ( config != NULL ) ? _git_eventc_post_receive_get_config_string(config, "diff.renames") : NULL;
+    if ( ( renames == NULL ) || ( *renames == '\0' ) || ( git_config_parse_bool(&value, renames) < 0 ) || value )
+    {
+        _git_eventc_diff_find_flags |= GIT_DIFF_FIND_RENAMES;
+        if ( ( renames != NULL ) && ( ( g_ascii_strcasecmp(renames, "copies") == 0 ) || ( g_ascii_strcasecmp(renames, "copy") == 0 ) ) )
+            _git_eventc_diff_find_flags |= GIT_DIFF_FIND_COPIES;
+    }
+    g_free(renames);
+    giterr_clear();
+}
+
+/*
+ * These are process-wide, so they are read once, from the global and
+ * system configuration only: a repository cannot change them for the
+ * pushes to the others in daemon mode
+ */
+static void
+_git_eventc_post_receive_set_cache_options(void)
+{
+    static const struct {
+        const gchar *name;
+        git_otype type;
+    } object_limits[] = {
+        { PACKAGE_NAME ".cache-commit-limit", GIT_OBJ_COMMIT },
+        { PACKAGE_NAME ".cache-tree-limit",   GIT_OBJ_TREE },
+        { PACKAGE_NAME ".cache-blob-limit",   GIT_OBJ_BLOB },
+        { PACKAGE_NAME ".cache-tag-limit",    GIT_OBJ_TAG },
+    };
+    git_config *config;
+    gsize value, i;
+
+    if ( git_config_open_default(&config) < 0 )
+    {
+        g_warning("Couldn't get global configuration: %s", giterr_last()->message);
+        giterr_clear();
+        return;
+    }
+
+    if ( _git_eventc_post_receive_get_config_size(config, PACKAGE_NAME ".cache-max-size", &value) )
+        git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t) value);
+    for ( i = 0 ; i < G_N_ELEMENTS(object_limits) ; ++i )
+    {
+        if ( _git_eventc_post_receive_get_config_size(config, object_limits[i].name, &value) )
+            git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, object_limits[i].type, (size_t) value);
+    }
+    if ( _git_eventc_post_receive_get_config_size(config, PACKAGE_NAME ".mwindow-size", &value) )
+        git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t) value);
+    if ( _git_eventc_post_receive_get_config_size(config, PACKAGE_NAME ".mwindow-mapped-limit", &value) )
+        git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t) value);
+
+    git_config_free(config);
+}
+
+static void
+_git_eventc_post_receive_init(GitEventcPostReceiveContext *context, const gchar *pusher, const gchar *repository_name)
+{
+    int error;
+    NkFormatString *repository_url = NULL;
+
+
+    git_config *config;
+    error = git_repository_config_snapshot(&config, context->repository);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't get repository configuration: %s", giterr_last()->message);
+        _git_eventc_post_receive_set_find_flags(NULL);
+    }
+    else
+    {
+        context->project_group = _git_eventc_post_receive_get_config_string(config, PACKAGE_NAME ".project-group");
+        context->project_name = _git_eventc_post_receive_get_config_string(config, PACKAGE_NAME ".project");
+        repository_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".repository-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME);
+        context->branch_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".branch-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_BRANCH);
+        context->tag_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".tag-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_TAG);
+        context->commit_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".commit-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_COMMIT);
+        context->diff_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".diff-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_OLD_COMMIT | GIT_EVENTC_POST_RECEIVE_FLAG_NEW_COMMIT);
+        context->repository_name = context->repository_config_name = _git_eventc_post_receive_get_config_string(config, PACKAGE_NAME ".repository");
+        context->extra_data = _git_eventc_post_receive_get_config_hash_table(config, PACKAGE_NAME ".extra-data");
+        context->hide_refs = _git_eventc_post_receive_get_config_string(config, PACKAGE_NAME ".new-branch-hide-refs");
+        context->path_projects = _git_eventc_post_receive_get_config_path_projects(config, PACKAGE_NAME ".path-project");
+        _git_eventc_post_receive_set_find_flags(config);
+
+        git_config_free(config);
+    }
+    context->project[0] = context->project_group;
+    context->project[1] = context->project_name;
+
+    if ( context->hide_refs == NULL )
+        context->hide_refs = g_strdup("refs/heads/*");
+
+    /* Use Gitolite env */
+    context->pusher = pusher;
+    if ( context->repository_name == NULL )
+        context->repository_name = repository_name;
+
+    if ( context->pusher == NULL )
+        context->pusher = "Jane Doe";
+    if ( context->repository_name == NULL )
+    {
+        const gchar *path = git_repository_path(context->repository);
+        if ( git_repository_is_bare(context->repository) )
+            context->repository_guessed_name = g_path_get_basename(path);
+        else
+        {
+            gsize last = strlen(path) - strlen("/.git/");
+            gchar *tmp;
+            tmp = g_utf8_strrchr(path, last, G_DIR_SEPARATOR);
+            context->repository_guessed_name = g_utf8_substring(path, (tmp+1 - path), last);
+        }
+        context->repository_name = context->repository_guessed_name;
+    }
+
+    if ( repository_url != NULL )
+    {
+        GitEventcPostReceiveFormatData data = {
+            .context = context,
+        };
+        context->repository_url = nk_format_string_replace(repository_url, _git_eventc_post_receive_url_format_replace, &data);
+        nk_format_string_unref(repository_url);
+    }
+
+    context->branch_creation_commits = _git_eventc_branch_creation_commits;
+    context->first_parent = _git_eventc_first_parent;
+    context->commit_count_limit = MAX(_git_eventc_commit_count_limit, 0);
+}
+
+static void
+_git_eventc_post_receive_clean(GitEventcPostReceiveContext *context)
+{
+    if ( context->tips != NULL )
+        g_array_unref(context->tips);
+    if ( context->path_projects != NULL )
+        g_array_unref(context->path_projects);
+    g_free(context->hide_refs);
+    if ( context->commits != NULL )
+        g_hash_table_unref(context->commits);
+    if ( context->tags != NULL )
+        g_hash_table_unref(context->tags);
+    if ( context->extra_data != NULL )
+        g_variant_unref(context->extra_data);
+    g_free(context->repository_guessed_name);
+    if ( context->diff_url != NULL )
+        nk_format_string_unref(context->diff_url);
+    if ( context->tag_url != NULL )
+        nk_format_string_unref(context->tag_url);
+    if ( context->commit_url != NULL )
+        nk_format_string_unref(context->commit_url);
+    if ( context->branch_url != NULL )
+        nk_format_string_unref(context->branch_url);
+    g_free(context->repository_url);
+    g_free(context->repository_config_name);
+    g_free(context->project_name);
+    g_free(context->project_group);
+}
+
+static GitEventcEventBase
+_git_eventc_post_receive_context_to_event_base(GitEventcPostReceiveContext *context)
+{
+    GitEventcEventBase base = {
+        .project = context->project,
+        .repository_name = context->repository_name,
+        .repository_url = context->repository_url,
+        .extra_data = context->extra_data,
+    };
+    return base;
+}
+
+static void
+_git_eventc_post_receive_ref_tip_clear(gpointer data)
+{
+    GitEventcPostReceiveRefTip *tip = data;
+
+    g_free(tip->name);
+}
+
+static GArray *
+_git_eventc_post_receive_get_tips(GitEventcPostReceiveContext *context)
+{
+    if ( context->tips != NULL )
+        return context->tips;
+
+    int error;
+    git_reference_iterator *iter;
+    git_reference *ref;
+    GHashTable *pushed;
+    guint i;
+
+    /* Built once, shared by all the new branches of this push */
+    context->tips = g_array_new(FALSE, FALSE, sizeof(GitEventcPostReceiveRefTip));
+    g_array_set_clear_func(context->tips, _git_eventc_post_receive_ref_tip_clear);
+
+    if ( *context->hide_refs == '\0' )
+        return context->tips;
+
+    /*
+     * The refs of this push must not hide each other, so we take them
+     * as they were before it: two new branches sharing their commits
+     * would hide them both otherwise
+     */
+    pushed = g_hash_table_new(g_str_hash, g_str_equal);
+    for ( i = 0 ; i < context->refs->len ; ++i )
+    {
+        GitEventcPostReceiveRef *pushed_ref = &g_array_index(context->refs, GitEventcPostReceiveRef, i);
+        g_hash_table_insert(pushed, (gpointer) pushed_ref->name, pushed_ref);
+    }
+
+    error = git_reference_iterator_glob_new(&iter, context->repository, context->hide_refs);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't list references: %s", giterr_last()->message);
+        goto out;
+    }
+
+    while ( ( error = git_reference_next(&ref, iter) ) == 0 )
+    {
+        GitEventcPostReceiveRef *pushed_ref;
+        git_object *target;
+
+        pushed_ref = g_hash_table_lookup(pushed, git_reference_name(ref));
+        if ( pushed_ref != NULL )
+        {
+            /* Taken below, with its old id */
+            pushed_ref->hide_listed = TRUE;
+            git_reference_free(ref);
+            continue;
+        }
+
+        if ( git_reference_peel(&target, ref, GIT_OBJ_COMMIT) == 0 )
+        {
+            GitEventcPostReceiveRefTip tip = {
+                .name = g_strdup(git_reference_name(ref)),
+            };
+            git_oid_cpy(&tip.id, git_object_id(target));
+            g_array_append_val(context->tips, tip);
+            git_object_free(target);
+        }
+        git_reference_free(ref);
+    }
+    if ( error != GIT_ITEROVER )
+        g_warning("Couldn't list references: %s", giterr_last()->message);
+    git_reference_iterator_free(iter);
+
+    for ( i = 0 ; i < context->refs->len ; ++i )
+    {
+        GitEventcPostReceiveRef *pushed_ref = &g_array_index(context->refs, GitEventcPostReceiveRef, i);
+
+        if ( git_oid_iszero(&pushed_ref->from) )
+            /* Created by this push, not a tip before it */
+            continue;
+        /* Deleted refs are not listed anymore, match them ourselves */
+        if ( ( ! pushed_ref->hide_listed ) && ( ! g_pattern_match_simple(context->hide_refs, pushed_ref->name) ) )
+            continue;
+
+        git_object *object, *target;
+        if ( git_object_lookup(&object, context->repository, &pushed_ref->from, GIT_OBJ_ANY) < 0 )
+            continue;
+        error = git_object_peel(&target, object, GIT_OBJ_COMMIT);
+        git_object_free(object);
+        if ( error < 0 )
+            continue;
+
+        GitEventcPostReceiveRefTip tip = {
+            .name = g_strdup(pushed_ref->name),
+        };
+        git_oid_cpy(&tip.id, git_object_id(target));
+        g_array_append_val(context->tips, tip);
+        git_object_free(target);
+    }
+    giterr_clear();
+
+out:
+    g_hash_table_unref(pushed);
+    return context->tips;
+}
+
+static gboolean
+_git_eventc_post_receive_hide_tips(GitEventcPostReceiveContext *context, git_revwalk *walker, const gchar *ref_name)
+{
+    GArray *tips = _git_eventc_post_receive_get_tips(context);
+    int error;
+    guint i;
+
+    for ( i = 0 ; i < tips->len ; ++i )
+    {
+        GitEventcPostReceiveRefTip *tip = &g_array_index(tips, GitEventcPostReceiveRefTip, i);
+        if ( g_strcmp0(tip->name, ref_name) == 0 )
+            continue;
+
+        error = git_revwalk_hide(walker, &tip->id);
+        if ( error < 0 )
+        {
+            g_warning("Couldn't hide %s tip: %s", tip->name, giterr_last()->message);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Commit groups summary: only the author is needed from each commit
+ */
+static void
+_git_eventc_post_receive_ref_summary_add(GitEventcPostReceiveContext *context, GitEventcPostReceiveRef *ref, const git_oid *id)
+{
+    int error;
+    git_commit *commit;
+
+    error = git_commit_lookup(&commit, context->repository, id);
+    if ( error < 0 )
+    {
+        giterr_clear();
+        return;
+    }
+
+    const git_signature *author = git_commit_author(commit);
+    gpointer count;
+
+    if ( ref->authors == NULL )
+    {
+        /* Topological order, newest first */
+        ref->authors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        git_oid_cpy(&ref->newest, id);
+    }
+    git_oid_cpy(&ref->oldest, id);
+
+    if ( g_hash_table_lookup_extended(ref->authors, author->name, NULL, &count) )
+        g_hash_table_replace(ref->authors, g_strdup(author->name), GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+    else
+        g_hash_table_insert(ref->authors, g_strdup(author->name), GUINT_TO_POINTER(1));
+
+    git_commit_free(commit);
+}
+
+static git_revwalk *
+_git_eventc_post_receive_branch_walker_new(GitEventcPostReceiveContext *context, GitEventcPostReceiveRef *ref)
+{
+    int error;
+    git_revwalk *walker;
+
+    error = git_revwalk_new(&walker, context->repository);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't initialize revision walker: %s", giterr_last()->message);
+        return NULL;
+    }
+
+    error = git_revwalk_push(walker, &ref->to);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't push the revision list head: %s", giterr_last()->message);
+        goto fail;
+    }
+    if ( ! git_oid_iszero(&ref->from) )
+    {
+        error = git_revwalk_hide(walker, &ref->from);
+        if ( error < 0 )
+        {
+            g_warning("Couldn't hide the revision list queue: %s", giterr_last()->message);
+            goto fail;
+        }
+    }
+    else if ( ! _git_eventc_post_receive_hide_tips(context, walker, ref->name) )
+        /* Only send commits that are new to the repository */
+        goto fail;
+    git_revwalk_sorting(walker, GIT_SORT_TOPOLOGICAL);
+    /* Merged commits were already sent when their branch was pushed */
+    if ( context->first_parent )
+        git_revwalk_simplify_first_parent(walker);
+
+    return walker;
+
+fail:
+    git_revwalk_free(walker);
+    return NULL;
+}
+
+static gboolean
+_git_eventc_post_receive_branch_walk(GitEventcPostReceiveContext *context, GitEventcPostReceiveRef *ref)
+{
+    int error;
+    git_revwalk *walker = NULL;
+    GArray *ids = NULL;
+    git_oid id;
+
+    if ( git_oid_iszero(&ref->to) )
+        return TRUE;
+    if ( git_oid_iszero(&ref->from) && ( ! context->branch_creation_commits ) )
+        return TRUE;
+
+    /*
+     * We walk only once, in topological order: libgit2 limits the whole
+     * range before the first commit anyway as soon as anything is hidden.
+     * We keep the ids while we are below the threshold and only count
+     * once we know we will send a commit-group.
+     */
+    walker = _git_eventc_post_receive_branch_walker_new(context, ref);
+    if ( walker == NULL )
+        goto cleanup;
+
+    ids = g_array_new(FALSE, FALSE, sizeof(git_oid));
+    while ( ( error = git_revwalk_next(&id, walker) ) == 0 )
+    {
+        if ( ( ++ref->size % GIT_EVENTC_POST_RECEIVE_POLL_COMMITS ) == 0 )
+            git_eventc_poll();
+        if ( ids == NULL )
+        {
+            _git_eventc_post_receive_ref_summary_add(context, ref, &id);
+            if ( ( context->commit_count_limit > 0 ) && ( ref->size >= context->commit_count_limit ) )
+            {
+                ref->approximate = TRUE;
+                break;
+            }
+        }
+        else if ( git_eventc_is_above_threshold(ref->size) )
+        {
+            /* Catch up with the commits we kept so far */
+            guint i;
+            for ( i = 0 ; i < ids->len ; ++i )
+                _git_eventc_post_receive_ref_summary_add(context, ref, &g_array_index(ids, git_oid, i));
+            _git_eventc_post_receive_ref_summary_add(context, ref, &id);
+            g_array_unref(ids);
+            ids = NULL;
+        }
+        else
+            g_array_append_val(ids, id);
+    }
+    if ( ( error < 0 ) && ( error != GIT_ITEROVER ) )
+    {
+        g_warning("Couldn't walk the revision list: %s", giterr_last()->message);
+        goto cleanup;
+    }
+
+    ref->walked = TRUE;
+    if ( ids == NULL )
+        goto cleanup;
+
+    /* Topological order, oldest first */
+    ref->commits = g_ptr_array_new_full(ids->len, _git_eventc_post_receive_commit_unref);
+    guint i;
+    for ( i = ids->len ; i > 0 ; --i )
+        g_ptr_array_add(ref->commits, _git_eventc_post_receive_commit_queue(context, &g_array_index(ids, git_oid, i - 1)));
+
+cleanup:
+    if ( ids != NULL )
+        g_array_unref(ids);
+    if ( walker != NULL )
+        git_revwalk_free(walker);
+    return ref->walked;
+}
+
+static gchar *
+_git_eventc_post_receive_get_commit_subject(GitEventcPostReceiveContext *context, const git_oid *id)
+{
+    git_commit *commit;
+    gchar *subject;
+    const gchar *message, *eol;
+
+    if ( git_commit_lookup(&commit, context->repository, id) < 0 )
+    {
+        giterr_clear();
+        return NULL;
+    }
+
+    message = git_commit_message(commit);
+    eol = strchr(message, '\n');
+    subject = ( eol != NULL ) ? g_strndup(message, eol - message) : g_strdup(message);
+    git_commit_free(commit);
+
+    return subject;
+}
+
+static GVariant *
+_git_eventc_post_receive_get_top_level_changes(GitEventcPostReceiveContext *context, GitEventcPostReceiveRef *ref)
+{
+    if ( git_oid_iszero(&ref->from) )
+        /* Everything would be new */
+        return NULL;
+
+    return git_eventc_post_receive_summary_top_level_changes(context->repository, &ref->from, &ref->to);
+}
+
+static void
+_git_eventc_post_receive_send_commit_group(GitEventcPostReceiveContext *context, GitEventcEventBase *base, GitEventcPostReceiveRef *ref, const gchar *branch)
+{
+    GVariant *authors = NULL, *author_counts = NULL;
+    gchar *first_subject = NULL, *last_subject = NULL;
+    gsize n;
+
+    if ( ref->authors != NULL )
+    {
+        git_eventc_post_receive_summary_authors(ref->authors, &authors, &author_counts);
+
+        /* We stopped counting before the first commit, we do not know it */
+        if ( ! ref->approximate )
+            first_subject = _git_eventc_post_receive_get_commit_subject(context, &ref->oldest);
+        last_subject = _git_eventc_post_receive_get_commit_subject(context, &ref->newest);
+    }
+    n = ( ref->authors != NULL ) ? g_hash_table_size(ref->authors) : 0;
+
+    git_eventc_send_commit_group(base, context->pusher, NULL, NULL, ref->size, branch,
+        "size-approximate", ref->approximate ? g_variant_new_boolean(TRUE) : NULL,
+        "authors", authors,
+        "author-counts", author_counts,
+        "author-count", ( n > 0 ) ? g_variant_new_uint32(n) : NULL,
+        "first-subject", ( first_subject != NULL ) ? g_variant_new_take_string(first_subject) : NULL,
+        "last-subject", ( last_subject != NULL ) ? g_variant_new_take_string(last_subject) : NULL,
+        "directories", _git_eventc_post_receive_get_top_level_changes(context, ref),
+        NULL);
+}
+
+/*
+ * One event per project touched by the commit, none if it touches nothing we route
+ */
+static void
+_git_eventc_post_receive_send_path_projects_commit(GitEventcPostReceiveContext *context, GitEventcEventBase *base, GitEventcPostReceiveCommit *commit, const gchar *idstr, const gchar *branch)
+{
+    const gchar *project[2] = { context->project[0], NULL };
+    const gchar **base_project = base->project;
+    gchar *url = base->url;
+    guint i;
+
+    if ( commit->path_projects_files == NULL )
+        goto out;
+
+    base->project = project;
+    for ( i = 0 ; i < context->path_projects->len ; ++i )
+    {
+        const GitEventcPostReceivePathProject *path_project = &g_array_index(context->path_projects, GitEventcPostReceivePathProject, i);
+        if ( commit->path_projects_files[i] == NULL )
+            continue;
+
+        project[1] = path_project->project;
+        base->url = g_strdup(url);
+        git_eventc_send_commit(base, idstr, commit->message, context->pusher, NULL, NULL, commit->author_name, NULL, commit->author_email, branch, commit->path_projects_files[i],
+            "similarity-skipped", commit->similarity_skipped ? g_variant_new_boolean(TRUE) : NULL,
+            NULL);
+    }
+    base->project = base_project;
+
+out:
+    g_free(url);
+    base->url = NULL;
+}
+
+static void
+_git_eventc_post_receive_branch(GitEventcPostReceiveContext *context, GitEventcPostReceiveRef *ref, const gchar *branch)
+{
+    GitEventcEventBase base = _git_eventc_post_receive_context_to_event_base(context);
+    gchar *diff_url = NULL;
+
+    if ( git_oid_iszero(&ref->from) )
+    {
+        if ( context->branch_url != NULL )
+        {
+            GitEventcPostReceiveFormatData data = {
+                .context = context,
+                .branch = branch,
+            };
+            base.url = git_eventc_get_url(nk_format_string_replace(context->branch_url, _git_eventc_post_receive_url_format_replace, &data));
+        }
+        git_eventc_send_branch_creation(&base, context->pusher, NULL, NULL, branch, NULL);
+    }
+    else if ( git_oid_iszero(&ref->to) )
+    {
+        git_eventc_send_branch_deletion(&base, context->pusher, NULL, NULL, branch, NULL);
+        goto send_push;
+    }
+
+    if ( ! ref->walked )
+        goto send_push;
+
+    if ( context->diff_url != NULL )
+    {
+        GitEventcPostReceiveFormatData data = {
+            .context = context,
+            .old_commit = ref->before,
+            .new_commit = ref->after,
+        };
+        diff_url = git_eventc_get_url(nk_format_string_replace(context->diff_url, _git_eventc_post_receive_url_format_replace, &data));
+    }
+
+    if ( ref->commits == NULL )
+    {
+        base.url = g_strdup(diff_url);
+        _git_eventc_post_receive_send_commit_group(context, &base, ref, branch);
+    }
+    else
+    {
+        char idstr[GIT_OID_HEXSZ+1];
+        guint i;
+        for ( i = 0 ; i < ref->commits->len ; ++i )
+        {
+            GitEventcPostReceiveCommit *commit = g_ptr_array_index(ref->commits, i);
+            if ( ! _git_eventc_post_receive_commit_lookup(context, commit) )
+                continue;
+
+            git_oid_tostr(idstr, sizeof(idstr), &commit->id);
+            base.url = NULL;
+            if ( context->commit_url != NULL )
+            {
+                GitEventcPostReceiveFormatData data = {
+                    .context = context,
+                    .commit = idstr,
+                };
+                base.url = git_eventc_get_url(nk_format_string_replace(context->commit_url, _git_eventc_post_receive_url_format_replace, &data));
+            }
+            const gchar *files;
+            gint64 start = g_get_monotonic_time();
+            files = _git_eventc_post_receive_commit_get_files(context, commit);
+            context->profile.analysis_wait += g_get_monotonic_time() - start;
+            if ( ! commit->profiled )
+            {
+                /* Commits shared by several refs are only analysed once */
+                context->profile.analysis += commit->analysis_time;
+                context->profile.similarity += commit->similarity_time;
+                commit->profiled = TRUE;
+            }
+
+            if ( context->path_projects != NULL )
+            {
+                _git_eventc_post_receive_send_path_projects_commit(context, &base, commit, idstr, branch);
+                continue;
+            }
+
+            git_eventc_send_commit(&base, idstr, commit->message, context->pusher, NULL, NULL, commit->author_name, NULL, commit->author_email, branch, files,
+                "similarity-skipped", commit->similarity_skipped ? g_variant_new_boolean(TRUE) : NULL,
+                NULL);
+        }
+    }
+
+send_push:
+    base.url = diff_url;
+    git_eventc_send_push(&base, context->pusher, NULL, NULL, branch, NULL);
+}
+
+static int
+_git_eventc_post_receive_tags_index_add(const char *name, git_oid *tag_id, void *payload)
+{
+    GitEventcPostReceiveContext *context = payload;
+    int error;
+    git_object *object, *target;
+
+    error = git_object_lookup(&object, context->repository, tag_id, GIT_OBJ_ANY);
+    if ( error < 0 )
+        return 0;
+    error = git_object_peel(&target, object, GIT_OBJ_COMMIT);
+    git_object_free(object);
+    if ( error < 0 )
+        /* Tag to a tree or a blob, cannot be a previous tag */
+        return 0;
+
+    /* Keep the first tag found, like git_tag_foreach() order did before */
+    if ( ! g_hash_table_contains(context->tags, git_object_id(target)) )
+        g_hash_table_insert(context->tags, g_slice_dup(git_oid, git_object_id(target)), g_strdup(name + strlen("refs/tags/")));
+    git_object_free(target);
+
+    return 0;
+}
+
+static GHashTable *
+_git_eventc_post_receive_get_tags_index(GitEventcPostReceiveContext *context)
+{
+    if ( context->tags != NULL )
+        return context->tags;
+
+    int error;
+
+    /* Peeled commit id => tag name, built once for all the refs of this push */
+    context->tags = g_hash_table_new_full(_git_eventc_oid_hash, _git_eventc_oid_equal, _git_eventc_oid_free, g_free);
+    error = git_tag_foreach(context->repository, _git_eventc_post_receive_tags_index_add, context);
+    if ( error < 0 )
+        g_warning("Couldn't walk the tag list: %s", giterr_last()->message);
+
+    return context->tags;
+}
+
+static const gchar *
+_git_eventc_post_receive_get_previous_tag(GitEventcPostReceiveContext *context, git_commit *commit)
+{
+    GHashTable *tags = _git_eventc_post_receive_get_tags_index(context);
+    const gchar *previous_tag_name = NULL;
+    int error;
+
+    if ( git_commit_parentcount(commit) == 0 )
+        return NULL;
+    if ( g_hash_table_size(tags) == 0 )
+        return NULL;
+    if ( ( g_hash_table_size(tags) == 1 ) && g_hash_table_contains(tags, git_commit_id(commit)) )
+        /* We are the only tag around */
+        return NULL;
+
+    git_revwalk *walker;
+    error = git_revwalk_new(&walker, context->repository);
+    if ( error < 0 )
+    {
+        g_warning("Couldn't initialize revision walker: %s", giterr_last()->message);
+        return NULL;
+    }
+    /*
+     * Date order walks incrementally, topological order would need
+     * the whole history before returning the first commit
+     */
+    git_revwalk_sorting(walker, GIT_SORT_TIME);
+
+    error = git_revwalk_push(walker, git_commit_parent_id(commit, 0));
+    if ( error < 0 )
+    {
+        g_warning("Couldn't push the revision list: %s", giterr_last()->message);
+        goto cleanup;
+    }
+
+    git_oid id;
+    while ( ( error = git_revwalk_next(&id, walker) ) != GIT_ITEROVER )
+    {
+        if ( error < 0 )
+        {
+            g_warning("Couldn't walk the revision list: %s", giterr_last()->message);
+            break;
+        }
+
+        previous_tag_name = g_hash_table_lookup(tags, &id);
+        if ( previous_tag_name != NULL )
+            break;
+    }
+
+cleanup:
+    git_revwalk_free(walker);
+    return previous_tag_name;
+}
+
+static void
+_git_eventc_post_receive_tag(GitEventcPostReceiveContext *context, GitEventcPostReceiveRef *ref, const gchar *tag_name)
+{
+    GitEventcEventBase base = _git_eventc_post_receive_context_to_event_base(context);
+    int error;
+    gchar *url = NULL;
+
+    if ( ! git_oid_iszero(&ref->from) )
+        git_eventc_send_tag_deletion(&base, context->pusher, NULL, NULL, tag_name, NULL);
+
+    if ( ! git_oid_iszero(&ref->to) )
+    {
+        git_commit *commit = NULL;
+        git_tag *tag = NULL;
+        git_signature no_author = { .name = NULL, .email = NULL };
+        const git_signature *author = &no_author;
+        const gchar *message = NULL;
+        const gchar *previous_tag_name = NULL;
+
+        if ( context->tag_url != NULL )
+        {
+            GitEventcPostReceiveFormatData data = {
+                .context = context,
+                .tag = tag_name,
+            };
+            url = git_eventc_get_url(nk_format_string_replace(context->tag_url, _git_eventc_post_receive_url_format_replace, &data));
+        }
+
+        error = git_tag_lookup(&tag, context->repository, &ref->to);
+        if ( error < 0 )
+            error = git_commit_lookup(&commit, context->repository, &ref->to);
+        else
+        {
+            author = git_tag_tagger(tag);
+            message = git_tag_message(tag);
+            error = git_commit_lookup(&commit, context->repository, git_tag_target_id(tag));
+        }
+        if ( error < 0 )
+            g_warning("Couldn't find tag commit: %s", giterr_last()->message);
+        else
+        {
+            gint64 start = g_get_monotonic_time();
+            previous_tag_name = _git_eventc_post_receive_get_previous_tag(context, commit);
+            context->profile.previous_tag += g_get_monotonic_time() - start;
+        }
+
+        base.url = g_strdup(url);
+        git_eventc_send_tag_creation(&base, context->pusher, NULL, NULL, tag_name, author->name, author->email, message, previous_tag_name, NULL);
+
+        if ( commit != NULL )
+            git_commit_free(commit);
+        if ( tag != NULL )
+            git_tag_free(tag);
+    }
+
+    base.url = url;
+    git_eventc_send_push(&base, context->pusher, NULL, NULL, NULL, NULL);
+}
+
+static void
+_git_eventc_post_receive(GitEventcPostReceiveContext *context, GitEventcPostReceiveRef *ref)
+{
+    if ( g_str_has_prefix(ref->name, "refs/heads/") )
+        _git_eventc_post_receive_branch(context, ref, ref->name + strlen("refs/heads/"));
+    else if ( g_str_has_prefix(ref->name, "refs/tags/") )
+        _git_eventc_post_receive_tag(context, ref, ref->name + strlen("refs/tags/"));
+}
+
+/* How many ref names we put in an aggregated push */
+#define GIT_EVENTC_POST_RECEIVE_REF_SAMPLES 10
+
+static void
+_git_eventc_post_receive_aggregate(GitEventcPostReceiveContext *context, GArray *refs)
+{
+    GitEventcEventBase base = _git_eventc_post_receive_context_to_event_base(context);
+    guint32 branch_creations = 0, branch_updates = 0, branch_deletions = 0;
+    guint32 tag_creations = 0, tag_updates = 0, tag_deletions = 0;
+    guint32 others = 0;
+    const gchar *samples[GIT_EVENTC_POST_RECEIVE_REF_SAMPLES + 1] = { NULL };
+    guint i;
+
+    /* Only look at the ids, we do not touch the repository at all here */
+    for ( i = 0 ; i < refs->len ; ++i )
+    {
+        GitEventcPostReceiveRef *ref = &g_array_index(refs, GitEventcPostReceiveRef, i);
+        gboolean creation = git_oid_iszero(&ref->from);
+        gboolean deletion = git_oid_iszero(&ref->to);
+
+        if ( g_str_has_prefix(ref->name, "refs/heads/") )
+            ++*( creation ? &branch_creations : deletion ? &branch_deletions : &branch_updates );
+        else if ( g_str_has_prefix(ref->name, "refs/tags/") )
+            ++*( creation ? &tag_creations : deletion ? &tag_deletions : &tag_updates );
+        else
+            ++others;
+
+        if ( i < GIT_EVENTC_POST_RECEIVE_REF_SAMPLES )
+            samples[i] = ref->name;
+    }
+
+    git_eventc_send_push(&base, context->pusher, NULL, NULL, NULL,
+        "ref-count", g_variant_new_uint32(refs->len),
+        "branch-creations", g_variant_new_uint32(branch_creations),
+        "branch-updates", g_variant_new_uint32(branch_updates),
+        "branch-deletions", g_variant_new_uint32(branch_deletions),
+        "tag-creations", g_variant_new_uint32(tag_creations),
+        "tag-updates", g_variant_new_uint32(tag_updates),
+        "tag-deletions", g_variant_new_uint32(tag_deletions),
+        "other-refs", g_variant_new_uint32(others),
+        "refs", g_variant_new_strv(samples, -1),
+        NULL);
+}
+
+static void
+_git_eventc_post_receive_ref_clear(gpointer data)
+{
+    GitEventcPostReceiveRef *ref = data;
+
+    if ( ref->authors != NULL )
+        g_hash_table_unref(ref->authors);
+    if ( ref->commits != NULL )
+        g_ptr_array_unref(ref->commits);
+}
+
+static GArray *
+_git_eventc_post_receive_parse_input(gchar *input, gsize length)
+{
+    GArray *refs;
+
+    refs = g_array_new(FALSE, TRUE, sizeof(GitEventcPostReceiveRef));
+    g_array_set_clear_func(refs, _git_eventc_post_receive_ref_clear);
+
+    gchar *w, *n;
+    for ( w = input ; ( n = g_utf8_strchr(w, length - ( w - input ), '\n') ) != NULL ; w = n + 1 )
+    {
+        *n = '\0';
+        const gchar *before = w, *after, *name;
+        gchar *s;
+
+        s = g_utf8_strchr(before, n - before, ' ');
+        if ( s == NULL )
+            /* Malformed line */
+            continue;
+        *s = '\0';
+        after = ++s;
+
+        s = g_utf8_strchr(after, n - after, ' ');
+        if ( s == NULL )
+            /* Malformed line */
+            continue;
+        *s = '\0';
+        name = ++s;
+
+        if ( ! g_str_has_prefix(name, "refs/") )
+            /* Malformed line */
+            continue;
+
+        GitEventcPostReceiveRef ref = {
+            .name = name,
+            .before = before,
+            .after = after,
+        };
+        if ( ( git_oid_fromstr(&ref.from, before) < 0 ) || ( git_oid_fromstr(&ref.to, after) < 0 ) )
+            /* Malformed line */
+            continue;
+
+        g_array_append_val(refs, ref);
+    }
+
+    return refs;
+}
+
+typedef struct {
+    GitEventcPostReceiveRefFilter *filter;
+    gboolean exclude;
+} GitEventcPostReceiveRefFilterConfigData;
+
+static int
+_git_eventc_post_receive_ref_filter_config_callback(const git_config_entry *entry, void *payload)
+{
+    GitEventcPostReceiveRefFilterConfigData *data = payload;
+
+    git_eventc_post_receive_ref_filter_add(data->filter, entry->value, data->exclude);
+
+    return 0;
+}
+
+/*
+ * Only the repository own configuration file is read here,
+ * we do not want to pay for opening the repository before filtering
+ */
+static GitEventcPostReceiveRefFilter *
+_git_eventc_post_receive_get_ref_filter(gchar **include_refs, gchar **exclude_refs)
 {
+    const gchar *git_dir = g_getenv("GIT_DIR");
+    GitEventcPostReceiveRefFilter *filter;
+    gchar **pattern;
+    gchar *path;
+    git_config *config;
     int error;
-    NkFormatString *repository_url = NULL;
 
+    filter = git_eventc_post_receive_ref_filter_new();
+    if ( include_refs != NULL )
+    {
+        for ( pattern = include_refs ; *pattern != NULL ; ++pattern )
+            git_eventc_post_receive_ref_filter_add(filter, *pattern, FALSE);
+    }
+    if ( exclude_refs != NULL )
+    {
+        for ( pattern = exclude_refs ; *pattern != NULL ; ++pattern )
+            git_eventc_post_receive_ref_filter_add(filter, *pattern, TRUE);
+    }
 
-    git_config *config;
-    error = git_repository_config_snapshot(&config, context->repository);
-    if ( error < 0 )
-        g_warning("Couldn't get repository configuration: %s", giterr_last()->message);
-    else
+    path = g_build_filename(( git_dir != NULL ) ? git_dir : ".", "config", NULL);
+    if ( g_file_test(path, G_FILE_TEST_IS_REGULAR) && ( git_config_open_ondisk(&config, path) == 0 ) )
     {
-        context->project_group = _git_eventc_post_receive_get_config_string(config, PACKAGE_NAME ".project-group");
-        context->project_name = _git_eventc_post_receive_get_config_string(config, PACKAGE_NAME ".project");
-        repository_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".repository-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME);
-        context->branch_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".branch-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_BRANCH);
-        context->tag_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".tag-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_TAG);
-        context->commit_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".commit-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_COMMIT);
-        context->diff_url = _git_eventc_post_receive_get_config_url_format(config, PACKAGE_NAME ".diff-url", GIT_EVENTC_POST_RECEIVE_FLAG_PROJECT_GROUP | GIT_EVENTC_POST_RECEIVE_FLAG_REPOSITORY_NAME | GIT_EVENTC_POST_RECEIVE_FLAG_OLD_COMMIT | GIT_EVENTC_POST_RECEIVE_FLAG_NEW_COMMIT);
-        context->repository_name = _git_eventc_post_receive_get_config_string(config, PACKAGE_NAME ".repository");
-        context->extra_data = _git_eventc_post_receive_get_config_hash_table(config, PACKAGE_NAME ".extra-data");
+        GitEventcPostReceiveRefFilterConfigData data = {
+            .filter = filter,
+        };
+
+        error = git_config_get_multivar_foreach(config, PACKAGE_NAME ".include-refs", NULL, _git_eventc_post_receive_ref_filter_config_callback, &data);
+        if ( ( error < 0 ) && ( error != GIT_ENOTFOUND ) )
+            g_warning("Couldn't read included refs: %s", giterr_last()->message);
+
+        data.exclude = TRUE;
+        error = git_config_get_multivar_foreach(config, PACKAGE_NAME ".exclude-refs", NULL, _git_eventc_post_receive_ref_filter_config_callback, &data);
+        if ( ( error < 0 ) && ( error != GIT_ENOTFOUND ) )
+            g_warning("Couldn't read excluded refs: %s", giterr_last()->message);
 
         git_config_free(config);
     }
-    context->project[0] = context->project_group;
-    context->project[1] = context->project_name;
+    giterr_clear();
+    g_free(path);
 
-    /* Use Gitolite env */
-    context->pusher = g_getenv("GL_USER");
-    if ( context->repository_name == NULL )
-        context->repository_name = g_getenv("GL_REPO");
+    return filter;
+}
 
-    if ( context->pusher == NULL )
-        context->pusher = "Jane Doe";
-    if ( context->repository_name == NULL )
+static gboolean
+_git_eventc_parse_percent_arg(const gchar *option_name, const gchar *value, guint8 *ret, GError **error)
+{
+    gint16 v = -1;
+    if ( value == NULL )
     {
-        const gchar *path = git_repository_path(context->repository);
-        if ( git_repository_is_bare(context->repository) )
-            context->repository_guessed_name = g_path_get_basename(path);
-        else
-        {
-            gsize last = strlen(path) - strlen("/.git/");
-            gchar *tmp;
-            tmp = g_utf8_strrchr(path, last, G_DIR_SEPARATOR);
-            context->repository_guessed_name = g_utf8_substring(path, (tmp+1 - path), last);
-        }
-        context->repository_name = context->repository_guessed_name;
+        *ret = 50;
+        return TRUE;
     }
 
-    if ( repository_url != NULL )
+    switch ( strlen(value) )
     {
-        GitEventcPostReceiveFormatData data = {
-            .context = context,
-        };
-        context->repository_url = nk_format_string_replace(repository_url, _git_eventc_post_receive_url_format_replace, &data);
-        nk_format_string_unref(repository_url);
+    case 4: /* strlen("100%") */
+        if ( g_strcmp0(value, "100%") == 0 )
+            v = 100;
+    break;
+    case 3: /* strlen("10%") */
+        if ( value[2] != '%' )
+            break;
+        /* fallthrough */
+    case 2: /* strlen("1%") || strlen("10") */
+        if ( value[1] == '%' )
+            v = g_ascii_digit_value(value[0]);
+        else if ( g_ascii_isdigit(value[0]) )
+            v = g_ascii_digit_value(value[0]) * 10 + g_ascii_digit_value(value[1]);
+    break;
+    case 1: /* strlen("1") */
+        v = g_ascii_digit_value(value[0]) * 10;
+    break;
+    }
+    if ( v < 0 )
+    {
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "'%s' requires the same value format as 'git diff %s'", option_name, option_name);
+        return FALSE;
     }
 
-    context->branch_creation_commits = branch_creation_commits;
+    *ret = v;
+    return TRUE;
 }
 
-static void
-_git_eventc_post_receive_clean(GitEventcPostReceiveContext *context)
+static gboolean
+_git_eventc_find_renames(const gchar *option_name, const gchar *value, gpointer data, GError **error)
 {
-    if ( context->extra_data != NULL )
-        g_variant_unref(context->extra_data);
-    g_free(context->repository_guessed_name);
-    if ( context->diff_url != NULL )
-        nk_format_string_unref(context->diff_url);
-    if ( context->tag_url != NULL )
-        nk_format_string_unref(context->tag_url);
-    if ( context->commit_url != NULL )
-        nk_format_string_unref(context->commit_url);
-    if ( context->branch_url != NULL )
-        nk_format_string_unref(context->branch_url);
-    g_free(context->project_name);
-    g_free(context->project_group);
+    guint8 v;
+    if ( ! _git_eventc_parse_percent_arg(option_name, value, &v, error) )
+        return FALSE;
+    _git_eventc_diff_find_options.flags |= GIT_DIFF_FIND_RENAMES;
+    _git_eventc_diff_find_options.rename_threshold = v;
+    return TRUE;
 }
 
-static GitEventcEventBase
-_git_eventc_post_receive_context_to_event_base(GitEventcPostReceiveContext *context)
+static gboolean
+_git_eventc_find_copies(const gchar *option_name, const gchar *value, gpointer data, GError **error)
 {
-    GitEventcEventBase base = {
-        .project = context->project,
-        .repository_name = context->repository_name,
-        .repository_url = context->repository_url,
-        .extra_data = context->extra_data,
-    };
-    return base;
+    guint8 v;
+    if ( ! _git_eventc_parse_percent_arg(option_name, value, &v, error) )
+        return FALSE;
+    _git_eventc_diff_find_options.flags |= GIT_DIFF_FIND_COPIES;
+    _git_eventc_diff_find_options.copy_threshold = v;
+    return TRUE;
 }
 
 static void
-_git_eventc_post_receive_branch(GitEventcPostReceiveContext *context, const gchar *ref_name, const gchar *branch, const gchar *before, const git_oid *from, const gchar *after, const git_oid *to)
+_git_eventc_post_receive_profile_report(GitEventcPostReceiveContext *context)
 {
+    GitEventcPostReceiveProfile *profile = &context->profile;
+    gint64 start, total;
+    gint64 shortener, send;
+    ssize_t cached = 0, allowed = 0;
+
+    /* Events queued while connecting are only sent (and timed) once connected */
+    start = g_get_monotonic_time();
+    git_eventc_wait_connection();
+    profile->connect = g_get_monotonic_time() - start;
+
+    total = g_get_monotonic_time() - profile->start;
+    git_eventc_take_timings(&shortener, &send);
+    git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &cached, &allowed);
+
+    gchar *values[] = {
+        g_strdup_printf("%" G_GINT64_FORMAT, total),
+        g_strdup_printf("%" G_GINT64_FORMAT, profile->config),
+        g_strdup_printf("%" G_GINT64_FORMAT, profile->walk),
+        g_strdup_printf("%" G_GINT64_FORMAT, profile->analysis),
+        g_strdup_printf("%" G_GINT64_FORMAT, profile->analysis_wait),
+        g_strdup_printf("%" G_GINT64_FORMAT, profile->similarity),
+        g_strdup_printf("%" G_GINT64_FORMAT, profile->previous_tag),
+        g_strdup_printf("%" G_GINT64_FORMAT, profile->connect),
+        g_strdup_printf("%" G_GINT64_FORMAT, shortener),
+        g_strdup_printf("%" G_GINT64_FORMAT, send),
+        g_strdup_printf("%" G_GSSIZE_FORMAT, (gssize) cached),
+        g_strdup_printf("%" G_GSSIZE_FORMAT, (gssize) allowed),
+    };
+    gchar *message = g_strdup_printf("%s: push took %s µs: config %s µs, walk %s µs, analysis %s µs (similarity %s µs, waited %s µs), previous tag %s µs, connection wait %s µs, shortener %s µs, send %s µs, object cache using %s bytes out of %s", context->repository_name, values[0], values[1], values[2], values[3], values[5], values[4], values[6], values[7], values[8], values[9], values[10], values[11]);
+    const GLogField fields[] = {
+        { "MESSAGE", message, -1 },
+        { "PRIORITY", "5", -1 },
+        { "GLIB_DOMAIN", G_LOG_DOMAIN, -1 },
+        { "GIT_EVENTC_REPOSITORY", context->repository_name, -1 },
+        { "GIT_EVENTC_TOTAL_USEC", values[0], -1 },
+        { "GIT_EVENTC_CONFIG_USEC", values[1], -1 },
+        { "GIT_EVENTC_WALK_USEC", values[2], -1 },
+        { "GIT_EVENTC_ANALYSIS_USEC", values[3], -1 },
+        { "GIT_EVENTC_ANALYSIS_WAIT_USEC", values[4], -1 },
+        { "GIT_EVENTC_SIMILARITY_USEC", values[5], -1 },
+        { "GIT_EVENTC_PREVIOUS_TAG_USEC", values[6], -1 },
+        { "GIT_EVENTC_CONNECT_USEC", values[7], -1 },
+        { "GIT_EVENTC_SHORTENER_USEC", values[8], -1 },
+        { "GIT_EVENTC_SEND_USEC", values[9], -1 },
+        { "GIT_EVENTC_OBJECT_CACHE_BYTES", values[10], -1 },
+        { "GIT_EVENTC_OBJECT_CACHE_MAX_BYTES", values[11], -1 },
+    };
+    g_log_structured_array(G_LOG_LEVEL_MESSAGE, fields, G_N_ELEMENTS(fields));
+
+    g_free(message);
+    gsize i;
+    for ( i = 0 ; i < G_N_ELEMENTS(values) ; ++i )
+        g_free(values[i]);
+
+    if ( ! _git_eventc_profile_event )
+        return;
+
     GitEventcEventBase base = _git_eventc_post_receive_context_to_event_base(context);
-    int error;
-    git_revwalk *walker = NULL;
-    gchar *diff_url = NULL;
+    git_eventc_send_stats(&base,
+        "total", g_variant_new_int64(total),
+        "config", g_variant_new_int64(profile->config),
+        "walk", g_variant_new_int64(profile->walk),
+        "analysis", g_variant_new_int64(profile->analysis),
+        "analysis-wait", g_variant_new_int64(profile->analysis_wait),
+        "similarity", g_variant_new_int64(profile->similarity),
+        "previous-tag", g_variant_new_int64(profile->previous_tag),
+        "connect", g_variant_new_int64(profile->connect),
+        "shortener", g_variant_new_int64(shortener),
+        "send", g_variant_new_int64(send),
+        "object-cache", g_variant_new_int64(cached),
+        "object-cache-max", g_variant_new_int64(allowed),
+        NULL);
+}
 
-    if ( git_oid_iszero(from) )
+static gint
+_git_eventc_post_receive_process(git_repository *repository, GitEventcPostReceivePool **pool, const gchar *pusher, const gchar *repository_name, gchar *input, gsize length)
+{
+    GitEventcPostReceiveContext context = { .repository = repository, .pool = *pool };
+    gint64 shortener, send, start;
+    gint retval = 0;
+
+    /* Only count this push */
+    git_eventc_take_timings(&shortener, &send);
+    git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &cached, &allowed);
+    context.profile.start = ( _git_eventc_hook_start != 0 ) ? _git_eventc_hook_start : g_get_monotonic_time();
+    _git_eventc_hook_start = 0;
+    _git_eventc_post_receive_init(&context, pusher, repository_name);
+    context.profile.config = g_get_monotonic_time() - context.profile.start;
+    if ( context.pool != NULL )
+        /* Idle since the previous push */
+        context.pool->path_projects = context.path_projects;
+
+    GArray *refs = _git_eventc_post_receive_parse_input(input, length);
+    guint i;
+
+    context.refs = refs;
+
+    if ( ( _git_eventc_multi_ref_threshold > 0 ) && ( refs->len > (guint) _git_eventc_multi_ref_threshold ) )
     {
-        if ( context->branch_url != NULL )
-        {
-            GitEventcPostReceiveFormatData data = {
-                .context = context,
-                .branch = branch,
-            };
-            base.url = git_eventc_get_url(nk_format_string_replace(context->branch_url, _git_eventc_post_receive_url_format_replace, &data));
-        }
-        git_eventc_send_branch_creation(&base, context->pusher, NULL, NULL, branch, NULL);
+        /* Mirror pushes and tag floods: one summary instead of thousands of events */
+        _git_eventc_post_receive_aggregate(&context, refs);
+        goto out;
+    }
 
-        if ( ! context->branch_creation_commits )
-            goto send_push;
+    /* Walk all the refs first, so analysis runs for all of them while we send */
+    for ( i = 0 ; i < refs->len ; ++i )
+    {
+        GitEventcPostReceiveRef *ref = &g_array_index(refs, GitEventcPostReceiveRef, i);
+        start = g_get_monotonic_time();
+        /* The push is then only partly announced, let spooled entries be retried */
+        if ( g_str_has_prefix(ref->name, "refs/heads/") && ( ! _git_eventc_post_receive_branch_walk(&context, ref) ) )
+            retval = 3;
+        context.profile.walk += g_get_monotonic_time() - start;
+        git_eventc_poll();
     }
-    else if ( git_oid_iszero(to) )
+
+    for ( i = 0 ; i < refs->len ; ++i )
     {
-        git_eventc_send_branch_deletion(&base, context->pusher, NULL, NULL, branch, NULL);
-        goto send_push;
+        _git_eventc_post_receive(&context, &g_array_index(refs, GitEventcPostReceiveRef, i));
+        git_eventc_poll();
     }
 
-    error = git_revwalk_new(&walker, context->repository);
-    if ( error < 0 )
+out:
+    g_array_unref(refs);
+    if ( context.pool != NULL )
+        _git_eventc_post_receive_pool_wait(context.pool);
+    *pool = context.pool;
+
+    if ( _git_eventc_profile || _git_eventc_profile_event )
+        _git_eventc_post_receive_profile_report(&context);
+
+    _git_eventc_post_receive_clean(&context);
+    giterr_clear();
+
+    return retval;
+}
+
+static GString *
+_git_eventc_post_receive_request_build(const gchar *input, gsize length)
+{
+    const gchar *pusher = g_getenv("GL_USER");
+    const gchar *repository_name = g_getenv("GL_REPO");
+    gchar *path = g_get_current_dir();
+    GString *request = g_string_sized_new(length + 256);
+
+    g_string_append_printf(request, "repository %s\n", path);
+    if ( pusher != NULL )
+        g_string_append_printf(request, "pusher %s\n", pusher);
+    if ( repository_name != NULL )
+        g_string_append_printf(request, "name %s\n", repository_name);
+    g_string_append_c(request, '\n');
+    g_string_append_len(request, input, length);
+    g_free(path);
+
+    return request;
+}
+
+static gboolean
+_git_eventc_post_receive_request_parse(gchar *data, gsize length, GitEventcPostReceiveRequest *request)
+{
+    gchar *w, *n;
+
+    *request = (GitEventcPostReceiveRequest) { .path = NULL };
+
+    /* Headers, up to an empty line */
+    for ( w = data ; ( n = memchr(w, '\n', length - ( w - data )) ) != NULL ; w = n + 1 )
     {
-        g_warning("Couldn't initialize revision walker: %s", giterr_last()->message);
-        goto cleanup;
+        *n = '\0';
+        if ( n == w )
+        {
+            request->input = n + 1;
+            request->length = length - ( request->input - data );
+            break;
+        }
+
+        if ( g_str_has_prefix(w, "repository ") )
+            request->path = w + strlen("repository ");
+        else if ( g_str_has_prefix(w, "pusher ") )
+            request->pusher = w + strlen("pusher ");
+        else if ( g_str_has_prefix(w, "name ") )
+            request->repository_name = w + strlen("name ");
     }
 
-    error = git_revwalk_push(walker, to);
-    if ( error < 0 )
+    if ( ( request->path == NULL ) || ( request->input == NULL ) )
     {
-        g_warning("Couldn't push the revision list head: %s", giterr_last()->message);
-        goto cleanup;
+        g_warning("Malformed request: no repository");
+        return FALSE;
     }
-    if ( ! git_oid_iszero(from) )
+
+    return TRUE;
+}
+
+static gboolean
+_git_eventc_post_receive_client(const gchar *socket_path, const gchar *input, gsize length, gint *retval)
+{
+    GError *error = NULL;
+    GSocketAddress *address;
+    GSocketClient *client;
+    GSocketConnection *connection;
+
+    address = g_unix_socket_address_new(socket_path);
+    client = g_socket_client_new();
+    connection = g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+    g_object_unref(client);
+    g_object_unref(address);
+    if ( connection == NULL )
     {
-        error = git_revwalk_hide(walker, from);
-        if ( error < 0 )
-        {
-            g_warning("Couldn't hide the revision list queue: %s", giterr_last()->message);
-            goto cleanup;
-        }
+        g_warning("Couldn't connect to daemon, working locally: %s", error->message);
+        g_clear_error(&error);
+        return FALSE;
     }
-    git_oid id;
-    guint size = 0;
-    while ( ( error = git_revwalk_next(&id, walker) ) == 0 )
-        ++size;
-    if ( error != GIT_ITEROVER )
+
+    /* From now on, we must not fall back to avoid duplicated events */
+    *retval = 5;
+
+    GString *request = _git_eventc_post_receive_request_build(input, length);
+
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    GDataInputStream *in = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    gchar *answer = NULL;
+
+    if ( ! g_output_stream_write_all(out, request->str, request->len, NULL, NULL, &error) )
+        goto error;
+    if ( ! g_socket_shutdown(g_socket_connection_get_socket(connection), FALSE, TRUE, &error) )
+        goto error;
+
+    answer = g_data_input_stream_read_line(in, NULL, NULL, &error);
+    if ( answer == NULL )
+        goto error;
+
+    *retval = g_ascii_strtoll(answer, NULL, 10);
+
+error:
+    if ( error != NULL )
     {
-        g_warning("Couldn't walk the revision list: %s", giterr_last()->message);
-        goto send_push;
+        g_warning("Couldn't talk to daemon: %s", error->message);
+        g_clear_error(&error);
     }
+    g_free(answer);
+    g_object_unref(in);
+    g_string_free(request, TRUE);
+    g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+    g_object_unref(connection);
 
+    return TRUE;
+}
 
-    if ( context->diff_url != NULL )
+typedef struct {
+    gchar *path;
+    git_repository *repository;
+    GitEventcPostReceivePool *pool;
+    GList link;
+} GitEventcPostReceiveRepository;
+
+typedef struct {
+    GHashTable *table;
+    GQueue lru;
+    guint size;
+} GitEventcPostReceiveRepositories;
+
+static void
+_git_eventc_post_receive_repository_free(gpointer data)
+{
+    GitEventcPostReceiveRepository *repository = data;
+
+    if ( repository->pool != NULL )
+        _git_eventc_post_receive_pool_free(repository->pool);
+    git_repository_free(repository->repository);
+    g_free(repository->path);
+
+    g_slice_free(GitEventcPostReceiveRepository, repository);
+}
+
+static GitEventcPostReceiveRepositories *
+_git_eventc_post_receive_repositories_new(guint size)
+{
+    GitEventcPostReceiveRepositories *self;
+
+    self = g_slice_new0(GitEventcPostReceiveRepositories);
+    self->table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _git_eventc_post_receive_repository_free);
+    self->size = MAX(size, 1);
+
+    return self;
+}
+
+static void
+_git_eventc_post_receive_repositories_free(GitEventcPostReceiveRepositories *self)
+{
+    g_hash_table_unref(self->table);
+
+    g_slice_free(GitEventcPostReceiveRepositories, self);
+}
+
+static GitEventcPostReceiveRepository *
+_git_eventc_post_receive_repositories_get(GitEventcPostReceiveRepositories *self, const gchar *path)
+{
+    GitEventcPostReceiveRepository *repository;
+
+    /*
+     * We keep the most recently pushed repositories around to keep
+     * libgit2 caches warm, each of them holds file descriptors and maps
+     */
+    repository = g_hash_table_lookup(self->table, path);
+    if ( repository != NULL )
     {
-        GitEventcPostReceiveFormatData data = {
-            .context = context,
-            .old_commit = before,
-            .new_commit = after,
-        };
-        diff_url = git_eventc_get_url(nk_format_string_replace(context->diff_url, _git_eventc_post_receive_url_format_replace, &data));
+        g_queue_unlink(&self->lru, &repository->link);
+        g_queue_push_head_link(&self->lru, &repository->link);
+        return repository;
     }
 
-    if ( git_eventc_is_above_threshold(size) )
+    repository = g_slice_new0(GitEventcPostReceiveRepository);
+    if ( git_repository_open(&repository->repository, path) < 0 )
     {
-        base.url = g_strdup(diff_url);
-        git_eventc_send_commit_group(&base, context->pusher, NULL, NULL, size, branch, NULL);
+        g_warning("Couldn't open repository %s: %s", path, giterr_last()->message);
+        giterr_clear();
+        g_slice_free(GitEventcPostReceiveRepository, repository);
+        return NULL;
     }
-    else
+    repository->path = g_strdup(path);
+    repository->link.data = repository;
+
+    if ( g_hash_table_size(self->table) >= self->size )
     {
-        git_revwalk_sorting(walker, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
-        error = git_revwalk_push(walker, to);
-        if ( error < 0 )
-        {
-            g_warning("Couldn't push the revision list head: %s", giterr_last()->message);
-            goto cleanup;
-        }
-        if ( ! git_oid_iszero(from) )
-        {
-            error = git_revwalk_hide(walker, from);
-            if ( error < 0 )
-            {
-                g_warning("Couldn't hide the revision list queue: %s", giterr_last()->message);
-                goto cleanup;
-            }
-        }
-        char idstr[GIT_OID_HEXSZ+1];
-        while ( ( error = git_revwalk_next(&id, walker) ) == 0 )
-        {
-            git_commit *commit;
-            git_commit_lookup(&commit, context->repository, &id);
+        GitEventcPostReceiveRepository *oldest = g_queue_pop_tail_link(&self->lru)->data;
+        g_hash_table_remove(self->table, oldest->path);
+    }
 
-            const git_signature *author = git_commit_author(commit);
+    g_hash_table_insert(self->table, repository->path, repository);
+    g_queue_push_head_link(&self->lru, &repository->link);
+    return repository;
+}
 
-            git_oid_tostr(idstr, sizeof(idstr), git_commit_id(commit));
-            base.url = NULL;
-            if ( context->commit_url != NULL )
-            {
-                GitEventcPostReceiveFormatData data = {
-                    .context = context,
-                    .commit = idstr,
-                };
-                base.url = git_eventc_get_url(nk_format_string_replace(context->commit_url, _git_eventc_post_receive_url_format_replace, &data));
-            }
-            gchar *files;
-            files = _git_eventc_commit_get_files(context->repository, commit);
+/* Clients send their whole request at once, this is plenty */
+#define GIT_EVENTC_POST_RECEIVE_DAEMON_TIMEOUT 30
+
+typedef struct {
+    GitEventcPostReceiveRepositories *repositories;
+    GSocketConnection *connection;
+    GByteArray *data;
+    guint8 buffer[4096];
+    gchar answer[12];
+} GitEventcPostReceiveDaemonClient;
 
-            git_eventc_send_commit(&base, idstr, git_commit_message(commit), context->pusher, NULL, NULL, author->name, NULL, author->email, branch, files, NULL);
+static void
+_git_eventc_post_receive_daemon_client_free(GitEventcPostReceiveDaemonClient *client)
+{
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->connection);
+    g_byte_array_unref(client->data);
 
-            g_free(files);
-            git_commit_free(commit);
-        }
-        if ( error != GIT_ITEROVER )
-            g_warning("Couldn't walk the revision list: %s", giterr_last()->message);
-    }
+    g_slice_free(GitEventcPostReceiveDaemonClient, client);
+}
 
-send_push:
-    base.url = diff_url;
-    git_eventc_send_push(&base, context->pusher, NULL, NULL, branch, NULL);
-    diff_url = NULL;
+static void
+_git_eventc_post_receive_daemon_answer_callback(GObject *stream, GAsyncResult *res, gpointer user_data)
+{
+    GitEventcPostReceiveDaemonClient *client = user_data;
+    GError *error = NULL;
 
-cleanup:
-    g_free(diff_url);
-    if ( walker != NULL )
-        git_revwalk_free(walker);
+    if ( ! g_output_stream_write_all_finish(G_OUTPUT_STREAM(stream), res, NULL, &error) )
+    {
+        g_warning("Couldn't answer client: %s", error->message);
+        g_clear_error(&error);
+    }
+
+    _git_eventc_post_receive_daemon_client_free(client);
 }
 
-typedef struct {
-    GitEventcPostReceiveContext *context;
-    git_oid *id;
-    const char *name;
-} GitEventcPostReceiveTagSearch;
+static void
+_git_eventc_post_receive_daemon_answer(GitEventcPostReceiveDaemonClient *client, gint retval)
+{
+    gsize l;
 
-static int
-_git_eventc_post_receive_is_tag(const char *name, git_oid *tag_id, void *payload)
+    l = g_snprintf(client->answer, sizeof(client->answer), "%d\n", retval);
+    g_output_stream_write_all_async(g_io_stream_get_output_stream(G_IO_STREAM(client->connection)), client->answer, l, G_PRIORITY_DEFAULT, NULL, _git_eventc_post_receive_daemon_answer_callback, client);
+}
+
+static void
+_git_eventc_post_receive_daemon_read_callback(GObject *stream, GAsyncResult *res, gpointer user_data)
 {
-    GitEventcPostReceiveTagSearch *search = payload;
-    int error;
-    git_tag *tag;
-    gboolean same;
+    GitEventcPostReceiveDaemonClient *client = user_data;
+    GError *error = NULL;
+    gssize r;
 
-    error = git_tag_lookup(&tag, search->context->repository, tag_id);
-    if ( error == 0 )
+    r = g_input_stream_read_finish(G_INPUT_STREAM(stream), res, &error);
+    if ( r > 0 )
     {
-        same = git_oid_equal(git_tag_target_id(tag), search->id);
-        git_tag_free(tag);
+        /* The client closes its side once the request is sent */
+        g_byte_array_append(client->data, client->buffer, r);
+        g_input_stream_read_async(G_INPUT_STREAM(stream), client->buffer, sizeof(client->buffer), G_PRIORITY_DEFAULT, NULL, _git_eventc_post_receive_daemon_read_callback, client);
+        return;
+    }
+    if ( r < 0 )
+    {
+        g_warning("Couldn't read request: %s", error->message);
+        g_clear_error(&error);
+        _git_eventc_post_receive_daemon_answer(client, 3);
+        return;
     }
-    else
-        same = git_oid_equal(tag_id, search->id);
 
-    if ( ! same )
-        return 0;
+    GitEventcPostReceiveRequest request;
+    GitEventcPostReceiveRepository *repository;
+    gint retval = 3;
+
+    if ( _git_eventc_post_receive_request_parse((gchar *) client->data->data, client->data->len, &request) && ( ( repository = _git_eventc_post_receive_repositories_get(client->repositories, request.path) ) != NULL ) )
+        retval = _git_eventc_post_receive_process(repository->repository, &repository->pool, request.pusher, request.repository_name, request.input, request.length);
 
-    search->name = name + strlen("refs/tags/");
-    return 1;
+    _git_eventc_post_receive_daemon_answer(client, retval);
 }
 
-static void
-_git_eventc_post_receive_tag(GitEventcPostReceiveContext *context, const gchar *ref_name, const gchar *tag_name, const gchar *before, const git_oid *from, const gchar *after, const git_oid *to)
+static gboolean
+_git_eventc_post_receive_daemon_incoming(GSocketService *service, GSocketConnection *connection, GObject *source_object, gpointer user_data)
 {
-    GitEventcEventBase base = _git_eventc_post_receive_context_to_event_base(context);
-    int error;
-    gchar *url = NULL;
+    GitEventcPostReceiveDaemonClient *client;
 
-    if ( ! git_oid_iszero(from) )
-        git_eventc_send_tag_deletion(&base, context->pusher, NULL, NULL, tag_name, NULL);
+    /* Only the processing itself runs on the main loop, a slow client does not hold the others */
+    client = g_slice_new0(GitEventcPostReceiveDaemonClient);
+    client->repositories = user_data;
+    client->connection = g_object_ref(connection);
+    client->data = g_byte_array_new();
+
+    g_socket_set_timeout(g_socket_connection_get_socket(connection), GIT_EVENTC_POST_RECEIVE_DAEMON_TIMEOUT);
+    g_input_stream_read_async(g_io_stream_get_input_stream(G_IO_STREAM(connection)), client->buffer, sizeof(client->buffer), G_PRIORITY_DEFAULT, NULL, _git_eventc_post_receive_daemon_read_callback, client);
+
+    return TRUE;
+}
+
+static GSocketService *
+_git_eventc_post_receive_daemon_init(const gchar *socket_path, GitEventcPostReceiveRepositories *repositories)
+{
+    GError *error = NULL;
+    GSocketService *service;
+    gboolean listening = FALSE;
+
+    service = g_socket_service_new();
 
-    if ( ! git_oid_iszero(to) )
+#ifdef ENABLE_SYSTEMD
+    gint systemd_fds;
+    systemd_fds = sd_listen_fds(TRUE);
+    if ( systemd_fds < 0 )
     {
-        git_commit *commit;
-        git_tag *tag = NULL;
-        git_signature no_author = { .name = NULL, .email = NULL };
-        const git_signature *author = &no_author;
-        const gchar *message = NULL;
-        const gchar *previous_tag_name = NULL;
+        g_warning("Failed to acquire systemd sockets: %s", g_strerror(-systemd_fds));
+        goto error;
+    }
 
-        if ( context->tag_url != NULL )
+    gint fd;
+    for ( fd = SD_LISTEN_FDS_START ; fd < SD_LISTEN_FDS_START + systemd_fds ; ++fd )
+    {
+        gint r;
+        r = sd_is_socket(fd, AF_UNIX, SOCK_STREAM, 1);
+        if ( r < 0 )
         {
-            GitEventcPostReceiveFormatData data = {
-                .context = context,
-                .tag = tag_name,
-            };
-            url = git_eventc_get_url(nk_format_string_replace(context->tag_url, _git_eventc_post_receive_url_format_replace, &data));
+            g_warning("Failed to verify systemd socket type: %s", g_strerror(-r));
+            goto error;
         }
 
-        error = git_tag_lookup(&tag, context->repository, to);
-        if ( error < 0 )
-            error = git_commit_lookup(&commit, context->repository, to);
-        else
+        if ( r == 0 )
+            continue;
+
+        GSocket *socket;
+
+        if ( ( socket = g_socket_new_from_fd(fd, &error) ) == NULL )
         {
-            author = git_tag_tagger(tag);
-            message = git_tag_message(tag);
-            error = git_commit_lookup(&commit, context->repository, git_tag_target_id(tag));
+            g_warning("Failed to take a socket from systemd: %s", error->message);
+            goto error;
         }
-        if ( error < 0 )
-            g_warning("Couldn't find tag commit: %s", giterr_last()->message);
-        else if ( git_commit_parentcount(commit) > 0 )
+
+        if ( ! g_socket_listener_add_socket(G_SOCKET_LISTENER(service), socket, NULL, &error) )
         {
-            git_revwalk *walker;
-            error = git_revwalk_new(&walker, context->repository);
-            if ( error < 0 )
-            {
-                g_warning("Couldn't initialize revision walker: %s", giterr_last()->message);
-                goto cleanup;
-            }
-            git_revwalk_sorting(walker, GIT_SORT_TOPOLOGICAL);
+            g_warning("Failed to listen on a socket from systemd: %s", error->message);
+            g_object_unref(socket);
+            goto error;
+        }
+        g_object_unref(socket);
+        listening = TRUE;
+    }
+#endif /* ENABLE_SYSTEMD */
 
-            git_commit *parent;
-            error = git_commit_parent(&parent, commit, 0);
-            if ( error < 0 )
-            {
-                g_warning("Couldn't get tag commit parent: %s", giterr_last()->message);
-                goto cleanup;
-            }
-            error = git_revwalk_push(walker, git_commit_id(parent));
-            if ( error < 0 )
-            {
-                g_warning("Couldn't push the revision list: %s", giterr_last()->message);
-                goto cleanup;
-            }
+    if ( ( ! listening ) && ( socket_path != NULL ) )
+    {
+        GSocketAddress *address;
 
-            git_oid id;
-            while ( ( error = git_revwalk_next(&id, walker) ) != GIT_ITEROVER )
-            {
-                if ( error < 0 )
-                {
-                    g_warning("Couldn't walk the revision list: %s", giterr_last()->message);
-                    break;
-                }
+        /* Remove a stale socket from a previous run */
+        g_unlink(socket_path);
 
-                GitEventcPostReceiveTagSearch search = {
-                    .context = context,
-                    .id = &id,
-                };
-                error = git_tag_foreach(context->repository, _git_eventc_post_receive_is_tag, &search);
-                if ( error < 0 )
-                {
-                    g_warning("Couldn't walk the tag list: %s", giterr_last()->message);
-                    break;
-                }
-                if ( error )
-                {
-                    previous_tag_name = search.name;
-                    break;
-                }
-            }
-            git_commit_free(commit);
+        address = g_unix_socket_address_new(socket_path);
+        listening = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error);
+        g_object_unref(address);
+        if ( ! listening )
+        {
+            g_warning("Couldn't listen on %s: %s", socket_path, error->message);
+            goto error;
         }
+    }
 
-        base.url = g_strdup(url);
-        git_eventc_send_tag_creation(&base, context->pusher, NULL, NULL, tag_name, author->name, author->email, message, previous_tag_name, NULL);
-
-    cleanup:
-        if ( tag != NULL )
-            git_tag_free(tag);
+    if ( ! listening )
+    {
+        g_warning("No socket to listen on, use --socket");
+        goto error;
     }
 
-    base.url = url;
-    git_eventc_send_push(&base, context->pusher, NULL, NULL, NULL, NULL);
-}
+    g_signal_connect(service, "incoming", G_CALLBACK(_git_eventc_post_receive_daemon_incoming), repositories);
+    g_socket_service_start(service);
 
-static void
-_git_eventc_post_receive(GitEventcPostReceiveContext *context, const gchar *before, const gchar *after, const gchar *ref_name)
-{
-    git_oid from, to;
-    git_oid_fromstr(&from, before);
-    git_oid_fromstr(&to, after);
+    return service;
 
-    if ( g_str_has_prefix(ref_name, "refs/heads/") )
-        _git_eventc_post_receive_branch(context, ref_name, ref_name + strlen("refs/heads/"), before, &from, after, &to);
-    else if ( g_str_has_prefix(ref_name, "refs/tags/") )
-        _git_eventc_post_receive_tag(context, ref_name, ref_name + strlen("refs/tags/"), before, &from, after, &to);
+error:
+    g_clear_error(&error);
+    g_object_unref(service);
+    return NULL;
 }
 
 static gboolean
-_git_eventc_parse_percent_arg(const gchar *option_name, const gchar *value, guint8 *ret, GError **error)
+_git_eventc_post_receive_spool(const gchar *spool_dir, const gchar *input, gsize length)
 {
-    gint16 v = -1;
-    if ( value == NULL )
-    {
-        *ret = 50;
-        return TRUE;
-    }
+    GError *error = NULL;
+    GString *request;
+    gchar *name, *path;
+    gboolean ret;
 
-    switch ( strlen(value) )
+    if ( g_mkdir_with_parents(spool_dir, 0700) < 0 )
     {
-    case 4: /* strlen("100%") */
-        if ( g_strcmp0(value, "100%") == 0 )
-            v = 100;
-    break;
-    case 3: /* strlen("10%") */
-        if ( value[2] != '%' )
-            break;
-        /* fallthrough */
-    case 2: /* strlen("1%") || strlen("10") */
-        if ( value[1] == '%' )
-            v = g_ascii_digit_value(value[0]);
-        else if ( g_ascii_isdigit(value[0]) )
-            v = g_ascii_digit_value(value[0]) * 10 + g_ascii_digit_value(value[1]);
-    break;
-    case 1: /* strlen("1") */
-        v = g_ascii_digit_value(value[0]) * 10;
-    break;
+        g_warning("Couldn't create spool directory %s: %s", spool_dir, g_strerror(errno));
+        return FALSE;
     }
-    if ( v < 0 )
+
+    /* Names sort in arrival order */
+    name = g_strdup_printf("%016" G_GINT64_FORMAT "-%d.push", g_get_real_time(), (gint) getpid());
+    path = g_build_filename(spool_dir, name, NULL);
+    request = _git_eventc_post_receive_request_build(input, length);
+
+    /* Temporary file and rename, the drain only picks up complete entries */
+    ret = g_file_set_contents_full(path, request->str, request->len, G_FILE_SET_CONTENTS_CONSISTENT | G_FILE_SET_CONTENTS_DURABLE, 0600, &error);
+    if ( ! ret )
     {
-        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "'%s' requires the same value format as 'git diff %s'", option_name, option_name);
-        return FALSE;
+        g_warning("Couldn't write spool entry: %s", error->message);
+        g_clear_error(&error);
     }
 
-    *ret = v;
-    return TRUE;
+    g_string_free(request, TRUE);
+    g_free(path);
+    g_free(name);
+
+    return ret;
 }
 
-static gboolean
-_git_eventc_find_renames(const gchar *option_name, const gchar *value, gpointer data, GError **error)
+static gint
+_git_eventc_post_receive_spool_compare(const gchar **a, const gchar **b)
 {
-    guint8 v;
-    if ( ! _git_eventc_parse_percent_arg(option_name, value, &v, error) )
-        return FALSE;
-    _git_eventc_diff_find_options.flags |= GIT_DIFF_FIND_RENAMES;
-    _git_eventc_diff_find_options.rename_threshold = v;
-    return TRUE;
+    return g_strcmp0(*a, *b);
 }
 
-static gboolean
-_git_eventc_find_copies(const gchar *option_name, const gchar *value, gpointer data, GError **error)
+static GPtrArray *
+_git_eventc_post_receive_spool_list(const gchar *spool_dir)
 {
-    guint8 v;
-    if ( ! _git_eventc_parse_percent_arg(option_name, value, &v, error) )
-        return FALSE;
-    _git_eventc_diff_find_options.flags |= GIT_DIFF_FIND_COPIES;
-    _git_eventc_diff_find_options.copy_threshold = v;
-    return TRUE;
+    GError *error = NULL;
+    GDir *dir;
+    const gchar *name;
+    GPtrArray *entries;
+
+    dir = g_dir_open(spool_dir, 0, &error);
+    if ( dir == NULL )
+    {
+        g_warning("Couldn't open spool directory: %s", error->message);
+        g_clear_error(&error);
+        return NULL;
+    }
+
+    entries = g_ptr_array_new_with_free_func(g_free);
+    while ( ( name = g_dir_read_name(dir) ) != NULL )
+    {
+        if ( g_str_has_suffix(name, ".push") )
+            g_ptr_array_add(entries, g_build_filename(spool_dir, name, NULL));
+    }
+    g_dir_close(dir);
+
+    g_ptr_array_sort(entries, (GCompareFunc) _git_eventc_post_receive_spool_compare);
+
+    return entries;
 }
 
 static gboolean
@@ -760,6 +2827,155 @@ _git_eventc_post_receive_disconnect_idle(gpointer user_data)
     return G_SOURCE_REMOVE;
 }
 
+#define GIT_EVENTC_POST_RECEIVE_SPOOL_BATCH 64
+
+static gint
+_git_eventc_post_receive_spool_drain_batch(GMainLoop *loop, GitEventcPostReceiveRepositories *repositories, GPtrArray *entries, guint first, guint last)
+{
+    GError *error = NULL;
+    gboolean *processed;
+    gint retval = 0;
+    guint i;
+
+    processed = g_newa(gboolean, last - first);
+    for ( i = first ; i < last ; ++i )
+    {
+        const gchar *path = g_ptr_array_index(entries, i);
+        gchar *data;
+        gsize length;
+        GitEventcPostReceiveRequest request;
+        GitEventcPostReceiveRepository *repository;
+
+        processed[i - first] = FALSE;
+        if ( ! g_file_get_contents(path, &data, &length, &error) )
+        {
+            /* Another drain may have taken it before we got the lock */
+            g_clear_error(&error);
+            continue;
+        }
+
+        if ( ! _git_eventc_post_receive_request_parse(data, length, &request) )
+        {
+            /* Out of the way, but kept for inspection */
+            gchar *bad_path = g_strconcat(path, ".bad", NULL);
+            g_warning("Setting aside malformed spool entry %s", path);
+            if ( g_rename(path, bad_path) < 0 )
+                g_warning("Couldn't rename spool entry %s: %s", path, g_strerror(errno));
+            g_free(bad_path);
+        }
+        else if ( ( ( repository = _git_eventc_post_receive_repositories_get(repositories, request.path) ) != NULL ) && ( _git_eventc_post_receive_process(repository->repository, &repository->pool, request.pusher, request.repository_name, request.input, request.length) == 0 ) )
+            processed[i - first] = TRUE;
+        else
+        {
+            g_warning("Keeping spool entry %s for the next drain", path);
+            retval = 3;
+        }
+        g_free(data);
+    }
+
+    /*
+     * Flush everything: eventd does not acknowledge events, so we only
+     * know they were all written to the connection and it closed cleanly
+     */
+    g_idle_add(_git_eventc_post_receive_disconnect_idle, NULL);
+    g_main_loop_run(loop);
+
+    if ( ! git_eventc_reset_send_status() )
+        return 2;
+
+    for ( i = first ; i < last ; ++i )
+    {
+        if ( processed[i - first] )
+            g_unlink(g_ptr_array_index(entries, i));
+    }
+
+    return retval;
+}
+
+static gint
+_git_eventc_post_receive_spool_drain(const gchar *spool_dir)
+{
+    gchar *lock_path;
+    gint lock_fd;
+    gint retval = 0;
+
+    lock_path = g_build_filename(spool_dir, ".lock", NULL);
+    lock_fd = g_open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    g_free(lock_path);
+    if ( lock_fd < 0 )
+    {
+        g_warning("Couldn't open spool lock: %s", g_strerror(errno));
+        return 3;
+    }
+
+    GMainLoop *loop;
+    GitEventcPostReceiveRepositories *repositories;
+    gboolean connected = FALSE;
+
+    _git_eventc_post_receive_set_cache_options();
+    loop = g_main_loop_new(NULL, FALSE);
+    repositories = _git_eventc_post_receive_repositories_new(_git_eventc_max_repositories);
+
+    /*
+     * Only one drain runs at a time, others leave their entry for it.
+     * A writer that could not lock because of us spooled before our
+     * unlock, so listing again once unlocked finds its entry.
+     * A later writer finds the lock free and drains its entry itself.
+     */
+    while ( flock(lock_fd, LOCK_EX | LOCK_NB) == 0 )
+    {
+        GPtrArray *entries;
+        gboolean done;
+        guint i;
+
+        entries = _git_eventc_post_receive_spool_list(spool_dir);
+        for ( i = 0 ; ( entries != NULL ) && ( i < entries->len ) ; i += GIT_EVENTC_POST_RECEIVE_SPOOL_BATCH )
+        {
+            guint last = MIN(i + GIT_EVENTC_POST_RECEIVE_SPOOL_BATCH, entries->len);
+
+            if ( ! connected )
+                connected = git_eventc_init(loop, &retval);
+            else
+                connected = git_eventc_connect();
+            if ( ! connected )
+            {
+                retval = 2;
+                break;
+            }
+
+            gint batch_retval = _git_eventc_post_receive_spool_drain_batch(loop, repositories, entries, i, last);
+            if ( batch_retval != 0 )
+                /* Failed entries wait for the next drain, we do not loop on them */
+                retval = batch_retval;
+            if ( batch_retval == 2 )
+                break;
+        }
+
+        flock(lock_fd, LOCK_UN);
+
+        if ( entries == NULL )
+            break;
+        done = ( retval != 0 );
+        if ( ( ! done ) && ( entries->len == 0 ) )
+        {
+            g_ptr_array_unref(entries);
+            entries = _git_eventc_post_receive_spool_list(spool_dir);
+            if ( entries == NULL )
+                break;
+            done = ( entries->len == 0 );
+        }
+        g_ptr_array_unref(entries);
+        if ( done )
+            break;
+    }
+
+    _git_eventc_post_receive_repositories_free(repositories);
+    g_main_loop_unref(loop);
+    g_close(lock_fd, NULL);
+
+    return retval;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -768,7 +2984,15 @@ main(int argc, char *argv[])
     gsize length;
     gboolean print_version;
     gboolean should_fork = FALSE;
-    gboolean branch_creation_commits = TRUE;
+    gboolean run_daemon = FALSE;
+    gchar *socket_path = NULL;
+    gchar *spool_dir = NULL;
+    gboolean drain = FALSE;
+    gchar *files_cache_dir = NULL;
+    gint files_cache_size = 64;
+    gchar **include_refs = NULL;
+    gchar **exclude_refs = NULL;
+    gint64 start = g_get_monotonic_time();
 
     int retval = 1;
 
@@ -781,10 +3005,28 @@ main(int argc, char *argv[])
 
     GOptionEntry entries[] =
     {
-        { "find-renames",               'M', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, &_git_eventc_find_renames, "See 'git help diff'", "<n>" },
-        { "find-copies",                'C', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, &_git_eventc_find_copies,  "See 'git help diff'", "<n>" },
-        { "fork",                       'F', G_OPTION_FLAG_NONE,         G_OPTION_ARG_NONE,     &should_fork,              "If git-eventc-post-receive should fork", NULL },
-        { "branch-creation-no-commits", 'B', G_OPTION_FLAG_REVERSE,      G_OPTION_ARG_NONE,     &branch_creation_commits,   "Do not send commit/commit-group events for new branches", NULL },
+        { "find-renames",               'M', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, &_git_eventc_find_renames,            "See 'git help diff'", "<n>" },
+        { "find-copies",                'C', G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, &_git_eventc_find_copies,             "See 'git help diff'", "<n>" },
+        { "fork",                       'F', G_OPTION_FLAG_NONE,         G_OPTION_ARG_NONE,     &should_fork,                         "If git-eventc-post-receive should fork", NULL },
+        { "branch-creation-no-commits", 'B', G_OPTION_FLAG_REVERSE,      G_OPTION_ARG_NONE,     &_git_eventc_branch_creation_commits, "Do not send commit/commit-group events for new branches", NULL },
+        { "first-parent",               'P', G_OPTION_FLAG_NONE,         G_OPTION_ARG_NONE,     &_git_eventc_first_parent,            "Only follow the first parent of merge commits", NULL },
+        { "profile",                    0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_NONE,     &_git_eventc_profile,                 "Log the time spent in each phase of a push", NULL },
+        { "profile-event",              0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_NONE,     &_git_eventc_profile_event,           "Also send these timings as a " PACKAGE_NAME " stats event", NULL },
+        { "jobs",                       'j', G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &_git_eventc_jobs,                    "Maximum number of commit analysis threads, started as commits come (defaults to 0, the number of processors)", "<jobs>" },
+        { "commit-count-limit",         'L', G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &_git_eventc_commit_count_limit,      "Stop counting commit-group commits at this number, it bounds the count, not the walk (defaults to 0, exact count)", "<limit>" },
+        { "multi-ref-threshold",        'R', G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &_git_eventc_multi_ref_threshold,     "Send a single aggregated push event above this number of refs (defaults to 0, never)", "<refs>" },
+        { "daemon",                     'd', G_OPTION_FLAG_NONE,         G_OPTION_ARG_NONE,     &run_daemon,                          "Run as a daemon, serving hook clients on --socket", NULL },
+        { "max-repositories",           0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &_git_eventc_max_repositories,        "Number of repositories the daemon keeps open (defaults to 16)", "<repositories>" },
+        { "socket",                     'S', G_OPTION_FLAG_NONE,         G_OPTION_ARG_FILENAME, &socket_path,                         "Daemon socket path (hooks forward their input to the daemon if set)", "<path>" },
+        { "spool",                      0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_FILENAME, &spool_dir,                           "Spool pushes to this directory before sending them", "<directory>" },
+        { "drain",                      0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_NONE,     &drain,                               "Send the pushes waiting in the spool and exit", NULL },
+        { "files-cache",                0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_FILENAME, &files_cache_dir,                     "Cache commits file lists in this directory", "<directory>" },
+        { "files-cache-size",           0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &files_cache_size,                    "Maximum files cache size in MiB (defaults to 64)", "<size>" },
+        { "find-max-files",             0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &_git_eventc_find_max_files,          "Skip renames/copies detection above this number of candidate files per commit (defaults to 1000, 0 for no limit)", "<files>" },
+        { "find-max-size",              0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &_git_eventc_find_max_size,           "Skip renames/copies detection above this size of candidate files per commit, in MiB (defaults to 64, 0 for no limit)", "<size>" },
+        { "find-timeout",               0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_INT,      &_git_eventc_find_timeout,            "Abort renames/copies detection after this time per commit, in milliseconds (defaults to 2000, 0 for no limit)", "<ms>" },
+        { "include-refs",               0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_STRING_ARRAY, &include_refs,                    "Only send events for refs matching this glob (can be repeated)", "<glob>" },
+        { "exclude-refs",               0,   G_OPTION_FLAG_NONE,         G_OPTION_ARG_STRING_ARRAY, &exclude_refs,                    "Never send events for refs matching this glob (can be repeated)", "<glob>" },
         { NULL }
     };
 
@@ -796,8 +3038,62 @@ main(int argc, char *argv[])
         goto end;
     }
 
+    if ( _git_eventc_jobs <= 0 )
+        _git_eventc_jobs = g_get_num_processors();
+    /* Set some diff options */
+    _git_eventc_diff_options.flags |= GIT_DIFF_INCLUDE_TYPECHANGE;
+
+    if ( files_cache_dir != NULL )
+    {
+        gchar *key;
+        key = g_strdup_printf("%08x-%08x-%u-%u", _git_eventc_diff_options.flags, _git_eventc_diff_find_options.flags, _git_eventc_diff_find_options.rename_threshold, _git_eventc_diff_find_options.copy_threshold);
+        _git_eventc_files_cache = git_eventc_post_receive_cache_new(files_cache_dir, key, (gsize) MAX(files_cache_size, 1) << 20);
+        g_free(key);
+    }
+
     retval = 0;
 
+    GMainLoop *loop;
+
+    if ( run_daemon )
+    {
+        _git_eventc_post_receive_set_cache_options();
+        loop = g_main_loop_new(NULL, FALSE);
+        if ( git_eventc_init(loop, &retval) )
+        {
+            GitEventcPostReceiveRepositories *repositories;
+            GSocketService *service;
+
+            repositories = _git_eventc_post_receive_repositories_new(_git_eventc_max_repositories);
+            service = _git_eventc_post_receive_daemon_init(socket_path, repositories);
+            if ( service != NULL )
+            {
+                g_main_loop_run(loop);
+                g_socket_service_stop(service);
+                g_object_unref(service);
+            }
+            else
+                retval = 3;
+            _git_eventc_post_receive_repositories_free(repositories);
+        }
+        else
+            retval = 2;
+        g_main_loop_unref(loop);
+        goto end;
+    }
+
+    if ( drain )
+    {
+        if ( spool_dir == NULL )
+        {
+            g_warning("--drain needs a --spool directory");
+            retval = 1;
+        }
+        else
+            retval = _git_eventc_post_receive_spool_drain(spool_dir);
+        goto end;
+    }
+
     GIOChannel *in;
 
     in = g_io_channel_unix_new(0);
@@ -811,6 +3107,39 @@ main(int argc, char *argv[])
     }
     g_io_channel_unref(in);
 
+    /* Filter as early as possible, neither the daemon nor the spool see the dropped refs */
+    GitEventcPostReceiveRefFilter *filter;
+    filter = _git_eventc_post_receive_get_ref_filter(include_refs, exclude_refs);
+    if ( ! git_eventc_post_receive_ref_filter_is_empty(filter) )
+        length = git_eventc_post_receive_ref_filter_input(filter, input, length);
+    git_eventc_post_receive_ref_filter_free(filter);
+    if ( length == 0 )
+        /* Nothing to tell, do not even open the repository */
+        goto end;
+
+    if ( ( socket_path != NULL ) && _git_eventc_post_receive_client(socket_path, input, length, &retval) )
+        goto end;
+
+    /* Once spooled, the push is safe: drain in the background */
+    if ( ( spool_dir != NULL ) && _git_eventc_post_receive_spool(spool_dir, input, length) )
+    {
+        switch ( fork() )
+        {
+        case 0:
+            g_close(0, NULL);
+            g_close(1, NULL);
+            g_close(2, NULL);
+            retval = _git_eventc_post_receive_spool_drain(spool_dir);
+        break;
+        case -1:
+            /* The next push or a --drain run will send it */
+            g_warning("Error while forking: %s", g_strerror(errno));
+        default:
+        break;
+        }
+        goto end;
+    }
+
     /* We read what we needed, it’s time to fork to do our blocking operations */
     if ( should_fork )
     switch ( fork() )
@@ -827,14 +3156,16 @@ main(int argc, char *argv[])
         goto end;
     }
 
-    GMainLoop *loop;
-
+    _git_eventc_post_receive_set_cache_options();
     loop = g_main_loop_new(NULL, FALSE);
-    if ( git_eventc_init(loop, &retval) )
+    /* Connect while we work, events wait for the connection */
+    if ( git_eventc_init_async(loop, &retval) )
     {
         int error;
         git_repository *repository = NULL;
+        GitEventcPostReceivePool *pool = NULL;
 
+        git_eventc_poll();
         error = git_repository_open(&repository, ".");
         if ( error < 0 )
         {
@@ -843,41 +3174,18 @@ main(int argc, char *argv[])
         }
         else
         {
-            GitEventcPostReceiveContext context = { .repository = repository };
-            _git_eventc_post_receive_init(&context, branch_creation_commits);
-            /* Set some diff options */
-            _git_eventc_diff_options.flags |= GIT_DIFF_INCLUDE_TYPECHANGE;
+            /* This push is all we do, our start-up counts as its configuration */
+            _git_eventc_hook_start = start;
+            retval = _git_eventc_post_receive_process(repository, &pool, g_getenv("GL_USER"), g_getenv("GL_REPO"), input, length);
+            if ( pool != NULL )
+                _git_eventc_post_receive_pool_free(pool);
 
-            gchar *w = input, *n;
-            while ( ( n = g_utf8_strchr(w, length - ( w - input ), '\n') ) != NULL )
-            {
-                *n = '\0';
-                const gchar *before = w, *after, *ref;
-                gchar *s;
-
-                s = g_utf8_strchr(before, n - before, ' ');
-                if ( s == NULL )
-                    /* Malformed line */
-                    continue;
-                *s = '\0';
-                after = ++s;
-
-                s = g_utf8_strchr(after, n - after, ' ');
-                if ( s == NULL )
-                    /* Malformed line */
-                    continue;
-                *s = '\0';
-                ref = ++s;
-
-                if ( ! g_str_has_prefix(ref, "refs/") )
-                    /* Malformed line */
-                    continue;
-
-                _git_eventc_post_receive(&context, before, after, ref);
-            }
             g_idle_add(_git_eventc_post_receive_disconnect_idle, NULL);
             g_main_loop_run(loop);
-            _git_eventc_post_receive_clean(&context);
+            /* The connection may have failed while we were working */
+            if ( ( ! git_eventc_reset_send_status() ) && ( retval == 0 ) )
+                retval = 2;
+            git_repository_free(repository);
         }
         giterr_clear();
     }
@@ -886,8 +3194,14 @@ main(int argc, char *argv[])
     g_main_loop_unref(loop);
 
 end:
+    git_eventc_post_receive_cache_free(_git_eventc_files_cache);
     git_eventc_uninit();
     git_libgit2_shutdown();
+    g_strfreev(exclude_refs);
+    g_strfreev(include_refs);
+    g_free(files_cache_dir);
+    g_free(spool_dir);
+    g_free(socket_path);
     g_free(input);
 
     return retval;
@@ -45,9 +45,9 @@ const gchar * const git_eventc_webhook_github_parsers_events[] = {
     [GIT_EVENTC_WEBHOOK_GITHUB_PARSER_PING]         = "ping",
 };
 
-void git_eventc_webhook_payload_parse_github_push(GitEventcEventBase *base, JsonObject *root);
-void git_eventc_webhook_payload_parse_github_issues(GitEventcEventBase *base, JsonObject *root);
-void git_eventc_webhook_payload_parse_github_pull_request(GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_github_push(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_github_issues(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_github_pull_request(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
 
 const GitEventcWebhookParseFunc git_eventc_webhook_github_parsers[] = {
     [GIT_EVENTC_WEBHOOK_GITHUB_PARSER_PUSH]         = git_eventc_webhook_payload_parse_github_push,
@@ -56,33 +56,38 @@ const GitEventcWebhookParseFunc git_eventc_webhook_github_parsers[] = {
     [GIT_EVENTC_WEBHOOK_GITHUB_PARSER_PING]         = NULL,
 };
 
+static void
+_git_eventc_webhook_github_fetch_user(GitEventcWebhookParse *parse, GitEventcEventBase *base, const gchar *name, JsonObject *user)
+{
+    git_eventc_webhook_parse_fetch_user(parse, base, name, json_object_get_string_member(user, "url"));
+}
+
 static JsonObject *
-_git_eventc_webhook_github_get_user(GitEventcEventBase *base, JsonObject *user)
+_git_eventc_webhook_github_get_user(GitEventcWebhookParse *parse, const gchar *name, JsonObject *user)
 {
     JsonNode *node;
 
-    node = git_eventc_webhook_api_get(base, json_object_get_string_member(user, "url"));
-    if ( node == NULL )
+    /* Fall back to the short user object from the payload */
+    node = git_eventc_webhook_parse_get_result(parse, name);
+    if ( ( node == NULL ) || ( ! JSON_NODE_HOLDS_OBJECT(node) ) )
         return json_object_ref(user);
 
-    user = json_object_ref(json_node_get_object(node));
-    json_node_free(node);
-
-    return user;
+    return json_object_ref(json_node_get_object(node));
 }
 
-static JsonArray *
-_git_eventc_webhook_github_get_tags(GitEventcEventBase *base, JsonObject *repository)
+static void
+_git_eventc_webhook_github_fetch_tags(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *repository)
 {
-    JsonNode *node;
-    JsonArray *tags;
+    const gchar *tags_url = json_object_get_string_member(repository, "tags_url");
+    gchar *url;
 
-    node = git_eventc_webhook_api_get(base, json_object_get_string_member(repository, "tags_url"));
-
-    tags = json_array_ref(json_node_get_array(node));
-    json_node_free(node);
+    if ( tags_url == NULL )
+        return;
 
-    return tags;
+    /* Enough to go on after a few deletions */
+    url = g_strdup_printf("%s%cper_page=" G_STRINGIFY(GIT_EVENTC_WEBHOOK_TAGS_MAX), tags_url, ( strchr(tags_url, '?') == NULL ) ? '?' : '&');
+    git_eventc_webhook_parse_fetch_tags(parse, base, tags_url, url);
+    g_free(url);
 }
 
 static gchar *
@@ -104,7 +109,7 @@ _git_eventc_webhook_payload_get_files_github(JsonObject *commit)
 }
 
 static void
-_git_eventc_webhook_payload_parse_github_branch(GitEventcEventBase *base, JsonObject *root, const gchar *branch)
+_git_eventc_webhook_payload_parse_github_branch(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root, const gchar *branch)
 {
     JsonObject *repository = json_object_get_object_member(root, "repository");
 
@@ -117,7 +122,7 @@ _git_eventc_webhook_payload_parse_github_branch(GitEventcEventBase *base, JsonOb
     gchar *namespace = g_strndup(full_name, g_utf8_strrchr(full_name, -1, '/') - full_name);
     base->repository_namespace = namespace;
 
-    JsonObject *sender = _git_eventc_webhook_github_get_user(base, json_object_get_object_member(root, "sender"));
+    JsonObject *sender = _git_eventc_webhook_github_get_user(parse, "sender", json_object_get_object_member(root, "sender"));
 
     gchar *diff_url;
     diff_url = git_eventc_get_url_const(json_object_get_string_member(root, "compare"));
@@ -205,7 +210,7 @@ send_push:
 }
 
 static void
-_git_eventc_webhook_payload_parse_github_tag(GitEventcEventBase *base, JsonObject *root, const gchar *tag)
+_git_eventc_webhook_payload_parse_github_tag(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root, const gchar *tag)
 {
     JsonObject *repository = json_object_get_object_member(root, "repository");
 
@@ -214,7 +219,7 @@ _git_eventc_webhook_payload_parse_github_tag(GitEventcEventBase *base, JsonObjec
     const gchar *full_name = json_object_get_string_member(repository, "full_name");
     gchar *namespace = g_strndup(full_name, g_utf8_strrchr(full_name, -1, '/') - full_name);
     base->repository_namespace = namespace;
-    JsonObject *sender = _git_eventc_webhook_github_get_user(base, json_object_get_object_member(root, "sender"));
+    JsonObject *sender = _git_eventc_webhook_github_get_user(parse, "sender", json_object_get_object_member(root, "sender"));
 
     if ( ! json_object_get_boolean_member(root, "created") )
             git_eventc_send_tag_deletion(base,
@@ -227,13 +232,9 @@ _git_eventc_webhook_payload_parse_github_tag(GitEventcEventBase *base, JsonObjec
 
     if ( ! json_object_get_boolean_member(root, "deleted") )
     {
-        JsonArray *tags = _git_eventc_webhook_github_get_tags(base, repository);
-        guint length = json_array_get_length(tags);
-        const gchar *previous_tag = NULL;
+        const gchar *previous_tag = git_eventc_webhook_parse_update_tags(parse, json_object_get_string_member(repository, "tags_url"), GIT_EVENTC_WEBHOOK_TAGS_ORDER_VERSION, tag, FALSE);
 
         base->url = git_eventc_get_url(g_strdup_printf("%s/releases/tag/%s", json_object_get_string_member(repository, "url"), tag));
-        if ( length > 1 )
-            previous_tag = json_object_get_string_member(json_array_get_object_element(tags, 1), "name");
 
         git_eventc_send_tag_creation(base,
             json_object_get_string_member(sender, "name"),
@@ -242,9 +243,9 @@ _git_eventc_webhook_payload_parse_github_tag(GitEventcEventBase *base, JsonObjec
             tag, NULL, NULL, NULL, previous_tag,
             "pusher-avatar-url", json_get_string_gvariant_safe(sender, "avatar_url"),
             NULL);
-
-        json_array_unref(tags);
     }
+    else
+        git_eventc_webhook_parse_update_tags(parse, json_object_get_string_member(repository, "tags_url"), GIT_EVENTC_WEBHOOK_TAGS_ORDER_VERSION, tag, TRUE);
 
     base->url = git_eventc_get_url_const(json_object_get_string_member(root, "compare"));
 
@@ -260,15 +261,29 @@ _git_eventc_webhook_payload_parse_github_tag(GitEventcEventBase *base, JsonObjec
     g_free(namespace);
 }
 
-void
-git_eventc_webhook_payload_parse_github_push(GitEventcEventBase *base, JsonObject *root)
+static void
+_git_eventc_webhook_payload_parse_github_push_send(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     const gchar *ref = json_object_get_string_member(root, "ref");
 
     if ( g_str_has_prefix(ref, "refs/heads/") )
-        _git_eventc_webhook_payload_parse_github_branch(base, root, ref + strlen("refs/heads/"));
+        _git_eventc_webhook_payload_parse_github_branch(parse, base, root, ref + strlen("refs/heads/"));
     else if ( g_str_has_prefix(ref, "refs/tags/") )
-        _git_eventc_webhook_payload_parse_github_tag(base, root, ref + strlen("refs/tags/"));
+        _git_eventc_webhook_payload_parse_github_tag(parse, base, root, ref + strlen("refs/tags/"));
+}
+
+void
+git_eventc_webhook_payload_parse_github_push(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
+{
+    const gchar *ref = json_object_get_string_member(root, "ref");
+
+    if ( ! ( g_str_has_prefix(ref, "refs/heads/") || g_str_has_prefix(ref, "refs/tags/") ) )
+        return;
+
+    _git_eventc_webhook_github_fetch_user(parse, base, "sender", json_object_get_object_member(root, "sender"));
+    if ( g_str_has_prefix(ref, "refs/tags/") && ( ! json_object_get_boolean_member(root, "deleted") ) )
+        _git_eventc_webhook_github_fetch_tags(parse, base, json_object_get_object_member(root, "repository"));
+    git_eventc_webhook_parse_then(parse, _git_eventc_webhook_payload_parse_github_push_send);
 }
 
 static const gchar * const _git_eventc_webhook_github_issue_action_name[] = {
@@ -277,18 +292,18 @@ static const gchar * const _git_eventc_webhook_github_issue_action_name[] = {
     [GIT_EVENTC_BUG_REPORT_ACTION_REOPENING] = "reopened",
 };
 
-void
-git_eventc_webhook_payload_parse_github_issues(GitEventcEventBase *base, JsonObject *root)
+static void
+_git_eventc_webhook_payload_parse_github_issues_send(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     const gchar *action_str = json_object_get_string_member(root, "action");
     guint64 action;
 
-    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_github_issue_action_name, GIT_EVENTC_BUG_REPORT_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
-        return;
+    /* Already checked by the first step */
+    nk_enum_parse(action_str, _git_eventc_webhook_github_issue_action_name, GIT_EVENTC_BUG_REPORT_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action);
 
     JsonObject *repository = json_object_get_object_member(root, "repository");
     JsonObject *issue = json_object_get_object_member(root, "issue");
-    JsonObject *author = _git_eventc_webhook_github_get_user(base, json_object_get_object_member(issue, "user"));
+    JsonObject *author = _git_eventc_webhook_github_get_user(parse, "author", json_object_get_object_member(issue, "user"));
 
     base->repository_name = json_object_get_string_member(repository, "name");
     base->repository_url = json_object_get_string_member(repository, "url");
@@ -327,6 +342,20 @@ git_eventc_webhook_payload_parse_github_issues(GitEventcEventBase *base, JsonObj
     g_free(namespace);
 }
 
+void
+git_eventc_webhook_payload_parse_github_issues(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
+{
+    const gchar *action_str = json_object_get_string_member(root, "action");
+    guint64 action;
+
+    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_github_issue_action_name, GIT_EVENTC_BUG_REPORT_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
+        return;
+
+    JsonObject *issue = json_object_get_object_member(root, "issue");
+    _git_eventc_webhook_github_fetch_user(parse, base, "author", json_object_get_object_member(issue, "user"));
+    git_eventc_webhook_parse_then(parse, _git_eventc_webhook_payload_parse_github_issues_send);
+}
+
 static const gchar * const _git_eventc_webhook_github_pull_request_action_name[] = {
     [GIT_EVENTC_MERGE_REQUEST_ACTION_OPENING]  = "opened",
     [GIT_EVENTC_MERGE_REQUEST_ACTION_CLOSING]  = "closed",
@@ -334,18 +363,18 @@ static const gchar * const _git_eventc_webhook_github_pull_request_action_name[]
     [GIT_EVENTC_MERGE_REQUEST_ACTION_MERGE] = "closed",
 };
 
-void
-git_eventc_webhook_payload_parse_github_pull_request(GitEventcEventBase *base, JsonObject *root)
+static void
+_git_eventc_webhook_payload_parse_github_pull_request_send(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     const gchar *action_str = json_object_get_string_member(root, "action");
     guint64 action;
 
-    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_github_pull_request_action_name, GIT_EVENTC_MERGE_REQUEST_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
-        return;
+    /* Already checked by the first step */
+    nk_enum_parse(action_str, _git_eventc_webhook_github_pull_request_action_name, GIT_EVENTC_MERGE_REQUEST_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action);
 
     JsonObject *repository = json_object_get_object_member(root, "repository");
     JsonObject *pr = json_object_get_object_member(root, "pull_request");
-    JsonObject *author = _git_eventc_webhook_github_get_user(base, json_object_get_object_member(pr, "user"));
+    JsonObject *author = _git_eventc_webhook_github_get_user(parse, "author", json_object_get_object_member(pr, "user"));
 
     base->repository_name = json_object_get_string_member(repository, "name");
     base->repository_url = json_object_get_string_member(repository, "url");
@@ -387,3 +416,17 @@ git_eventc_webhook_payload_parse_github_pull_request(GitEventcEventBase *base, J
     json_object_unref(author);
     g_free(namespace);
 }
+
+void
+git_eventc_webhook_payload_parse_github_pull_request(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
+{
+    const gchar *action_str = json_object_get_string_member(root, "action");
+    guint64 action;
+
+    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_github_pull_request_action_name, GIT_EVENTC_MERGE_REQUEST_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
+        return;
+
+    JsonObject *pr = json_object_get_object_member(root, "pull_request");
+    _git_eventc_webhook_github_fetch_user(parse, base, "author", json_object_get_object_member(pr, "user"));
+    git_eventc_webhook_parse_then(parse, _git_eventc_webhook_payload_parse_github_pull_request_send);
+}
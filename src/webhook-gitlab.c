@@ -53,12 +53,12 @@ static const gchar * const git_eventc_webhook_gitlab_parsers_system_events[] = {
     [GIT_EVENTC_WEBHOOK_GITLAB_PARSER_MERGE_REQUEST] = "merge_request",
 };
 
-void git_eventc_webhook_payload_parse_gitlab_branch(GitEventcEventBase *base, JsonObject *root);
-void git_eventc_webhook_payload_parse_gitlab_tag(GitEventcEventBase *base, JsonObject *root);
-void git_eventc_webhook_payload_parse_gitlab_issue(GitEventcEventBase *base, JsonObject *root);
-void git_eventc_webhook_payload_parse_gitlab_merge_request(GitEventcEventBase *base, JsonObject *root);
-void git_eventc_webhook_payload_parse_gitlab_pipeline(GitEventcEventBase *base, JsonObject *root);
-void git_eventc_webhook_payload_parse_gitlab_system(GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_gitlab_branch(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_gitlab_tag(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_gitlab_issue(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_gitlab_merge_request(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_gitlab_pipeline(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+void git_eventc_webhook_payload_parse_gitlab_system(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
 
 const GitEventcWebhookParseFunc git_eventc_webhook_gitlab_parsers[] = {
     [GIT_EVENTC_WEBHOOK_GITLAB_PARSER_PUSH]          = git_eventc_webhook_payload_parse_gitlab_branch,
@@ -69,8 +69,8 @@ const GitEventcWebhookParseFunc git_eventc_webhook_gitlab_parsers[] = {
     [GIT_EVENTC_WEBHOOK_GITLAB_PARSER_SYSTEM]        = git_eventc_webhook_payload_parse_gitlab_system,
 };
 
-static JsonNode *
-_git_eventc_webhook_gitlab_api_get(GitEventcEventBase *base, JsonObject *repository, const gchar *suffix, gsize length)
+static void
+_git_eventc_webhook_gitlab_api_fetch(GitEventcWebhookParse *parse, GitEventcEventBase *base, GitEventcWebhookParseFetchFunc fetch, const gchar *name, JsonObject *repository, const gchar *suffix, gsize length)
 {
     const gchar *web_url = json_object_get_string_member(repository, "web_url");
     const gchar *path_with_namespace = json_object_get_string_member(repository, "path_with_namespace");
@@ -82,11 +82,11 @@ _git_eventc_webhook_gitlab_api_get(GitEventcEventBase *base, JsonObject *reposit
     url = g_alloca(sizeof(gchar) * l);
     g_snprintf(url, l, "%.*sapi/v4%s", (gint) pl, web_url, suffix);
 
-    return git_eventc_webhook_api_get(base, url);
+    fetch(parse, base, name, url);
 }
 
-static JsonNode *
-_git_eventc_webhook_gitlab_api_get_project(GitEventcEventBase *base, JsonObject *repository, const gchar *suffix, gsize length)
+static void
+_git_eventc_webhook_gitlab_api_fetch_project(GitEventcWebhookParse *parse, GitEventcEventBase *base, GitEventcWebhookParseFetchFunc fetch, const gchar *name, JsonObject *repository, const gchar *suffix, gsize length)
 {
     gint64 id = json_object_get_int_member(repository, "id");
     gsize l;
@@ -96,11 +96,11 @@ _git_eventc_webhook_gitlab_api_get_project(GitEventcEventBase *base, JsonObject
     url = g_alloca(sizeof(gchar) * l);
     g_snprintf(url, l, "/projects/%" G_GINT64_FORMAT"%s", id, suffix);
 
-    return _git_eventc_webhook_gitlab_api_get(base, repository, url, l - 1);
+    _git_eventc_webhook_gitlab_api_fetch(parse, base, fetch, name, repository, url, l - 1);
 }
 
-static JsonObject *
-_git_eventc_webhook_gitlab_get_user(GitEventcEventBase *base, JsonObject *repository, gint64 id)
+static void
+_git_eventc_webhook_gitlab_fetch_user(GitEventcWebhookParse *parse, GitEventcEventBase *base, const gchar *name, JsonObject *repository, gint64 id)
 {
     gsize l;
     gchar *url;
@@ -110,15 +110,19 @@ _git_eventc_webhook_gitlab_get_user(GitEventcEventBase *base, JsonObject *reposi
 
     g_debug("GET USER %s", url);
 
+    _git_eventc_webhook_gitlab_api_fetch(parse, base, git_eventc_webhook_parse_fetch_user, name, repository, url, l - 1);
+}
+
+static JsonObject *
+_git_eventc_webhook_gitlab_get_user(GitEventcWebhookParse *parse, const gchar *name)
+{
     JsonNode *node;
-    JsonObject *user;
-    node = _git_eventc_webhook_gitlab_api_get(base, repository, url, l - 1);
-    if ( node == NULL )
+
+    node = git_eventc_webhook_parse_get_result(parse, name);
+    if ( ( node == NULL ) || ( ! JSON_NODE_HOLDS_OBJECT(node) ) )
         return NULL;
-    user = json_object_ref(json_node_get_object(node));
-    json_node_free(node);
 
-    return user;
+    return json_node_get_object(node);
 }
 
 static const gchar *
@@ -139,18 +143,12 @@ _git_eventc_webhook_gitlab_get_email_gvariant(JsonObject *object, const gchar *m
     return ( email == NULL ) ? NULL : g_variant_new_string(email);
 }
 
-static JsonArray *
-_git_eventc_webhook_gitlab_get_tags(GitEventcEventBase *base, JsonObject *repository)
+static void
+_git_eventc_webhook_gitlab_fetch_tags(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *repository)
 {
-    JsonNode *node;
-    JsonArray *tags;
-
-    node = _git_eventc_webhook_gitlab_api_get_project(base, repository, "/repository/tags", strlen("/repository/tags"));
-
-    tags = json_array_ref(json_node_get_array(node));
-    json_node_free(node);
-
-    return tags;
+    /* Enough to go on after a few deletions */
+    const gchar *suffix = "/repository/tags?order_by=updated&sort=desc&per_page=" G_STRINGIFY(GIT_EVENTC_WEBHOOK_TAGS_MAX);
+    _git_eventc_webhook_gitlab_api_fetch_project(parse, base, git_eventc_webhook_parse_fetch_tags, json_object_get_string_member(repository, "web_url"), repository, suffix, strlen(suffix));
 }
 
 static gchar *
@@ -172,7 +170,7 @@ _git_eventc_webhook_payload_get_files_gitlab(JsonObject *commit)
 }
 
 void
-git_eventc_webhook_payload_parse_gitlab_branch(GitEventcEventBase *base, JsonObject *root)
+git_eventc_webhook_payload_parse_gitlab_branch(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     const gchar *branch = json_object_get_string_member(root, "ref") + strlen("refs/heads/");
 
@@ -275,8 +273,8 @@ send_push:
     g_free(namespace);
 }
 
-void
-git_eventc_webhook_payload_parse_gitlab_tag(GitEventcEventBase *base, JsonObject *root)
+static void
+_git_eventc_webhook_payload_parse_gitlab_tag_send(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     const gchar *tag = json_object_get_string_member(root, "ref") + strlen("refs/tags/");
 
@@ -295,6 +293,9 @@ git_eventc_webhook_payload_parse_gitlab_tag(GitEventcEventBase *base, JsonObject
     gchar *url;
     url = git_eventc_get_url(g_strdup_printf("%s/tags/%s", web_url, tag));
 
+    if ( g_strcmp0(after, "0000000000000000000000000000000000000000") == 0 )
+        git_eventc_webhook_parse_update_tags(parse, web_url, GIT_EVENTC_WEBHOOK_TAGS_ORDER_PUSH, tag, TRUE);
+
     if ( g_strcmp0(before, "0000000000000000000000000000000000000000") != 0 )
             git_eventc_send_tag_deletion(base,
             json_object_get_string_member(root, "user_name"),
@@ -306,12 +307,7 @@ git_eventc_webhook_payload_parse_gitlab_tag(GitEventcEventBase *base, JsonObject
 
     if ( g_strcmp0(after, "0000000000000000000000000000000000000000") != 0 )
     {
-        JsonArray *tags = _git_eventc_webhook_gitlab_get_tags(base, repository);
-        guint length = json_array_get_length(tags);
-        const gchar *previous_tag = NULL;
-
-        if ( length > 1 )
-            previous_tag = json_object_get_string_member(json_array_get_object_element(tags, 1), "name");
+        const gchar *previous_tag = git_eventc_webhook_parse_update_tags(parse, web_url, GIT_EVENTC_WEBHOOK_TAGS_ORDER_PUSH, tag, FALSE);
 
         base->url = g_strdup(url);
         git_eventc_send_tag_creation(base,
@@ -321,8 +317,6 @@ git_eventc_webhook_payload_parse_gitlab_tag(GitEventcEventBase *base, JsonObject
             tag, NULL, NULL, NULL, previous_tag,
             "pusher-avatar-url", json_get_string_gvariant_safe(root, "user_avatar"),
             NULL);
-
-        json_array_unref(tags);
     }
 
     base->url = url;
@@ -337,25 +331,31 @@ git_eventc_webhook_payload_parse_gitlab_tag(GitEventcEventBase *base, JsonObject
     g_free(namespace);
 }
 
+void
+git_eventc_webhook_payload_parse_gitlab_tag(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
+{
+    const gchar *after = json_object_get_string_member(root, "after");
+
+    if ( g_strcmp0(after, "0000000000000000000000000000000000000000") != 0 )
+        _git_eventc_webhook_gitlab_fetch_tags(parse, base, json_object_get_object_member(root, "project"));
+    git_eventc_webhook_parse_then(parse, _git_eventc_webhook_payload_parse_gitlab_tag_send);
+}
+
 static const gchar * const _git_eventc_webhook_gitlab_issue_action_name[] = {
     [GIT_EVENTC_BUG_REPORT_ACTION_OPENING]  = "open",
     [GIT_EVENTC_BUG_REPORT_ACTION_CLOSING]  = "close",
     [GIT_EVENTC_BUG_REPORT_ACTION_REOPENING] = "reopen",
 };
 
-void
-git_eventc_webhook_payload_parse_gitlab_issue(GitEventcEventBase *base, JsonObject *root)
+static void
+_git_eventc_webhook_payload_parse_gitlab_issue_send(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     JsonObject *issue = json_object_get_object_member(root, "object_attributes");
-
-    if ( ! json_object_has_member(issue, "action") )
-        return;
-
     const gchar *action_str = json_object_get_string_member(issue, "action");
     guint64 action;
 
-    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_gitlab_issue_action_name, GIT_EVENTC_BUG_REPORT_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
-        return;
+    /* Already checked by the first step */
+    nk_enum_parse(action_str, _git_eventc_webhook_gitlab_issue_action_name, GIT_EVENTC_BUG_REPORT_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action);
 
     JsonObject *repository = json_object_get_object_member(root, "project");
     base->repository_name = json_object_get_string_member(repository, "name");
@@ -365,7 +365,7 @@ git_eventc_webhook_payload_parse_gitlab_issue(GitEventcEventBase *base, JsonObje
     base->repository_namespace = namespace;
 
     JsonObject *user = json_object_get_object_member(root, "user");
-    JsonObject *author = _git_eventc_webhook_gitlab_get_user(base, repository, json_object_get_int_member(issue, "author_id"));
+    JsonObject *author = _git_eventc_webhook_gitlab_get_user(parse, "author");
 
     JsonArray *tags_array = json_object_get_array_member(root, "labels");
     guint length = json_array_get_length(tags_array);
@@ -401,6 +401,24 @@ git_eventc_webhook_payload_parse_gitlab_issue(GitEventcEventBase *base, JsonObje
     g_free(namespace);
 }
 
+void
+git_eventc_webhook_payload_parse_gitlab_issue(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
+{
+    JsonObject *issue = json_object_get_object_member(root, "object_attributes");
+
+    if ( ! json_object_has_member(issue, "action") )
+        return;
+
+    const gchar *action_str = json_object_get_string_member(issue, "action");
+    guint64 action;
+
+    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_gitlab_issue_action_name, GIT_EVENTC_BUG_REPORT_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
+        return;
+
+    _git_eventc_webhook_gitlab_fetch_user(parse, base, "author", json_object_get_object_member(root, "project"), json_object_get_int_member(issue, "author_id"));
+    git_eventc_webhook_parse_then(parse, _git_eventc_webhook_payload_parse_gitlab_issue_send);
+}
+
 static const gchar * const _git_eventc_webhook_gitlab_merge_request_action_name[] = {
     [GIT_EVENTC_MERGE_REQUEST_ACTION_OPENING]  = "open",
     [GIT_EVENTC_MERGE_REQUEST_ACTION_CLOSING]  = "close",
@@ -408,15 +426,15 @@ static const gchar * const _git_eventc_webhook_gitlab_merge_request_action_name[
     [GIT_EVENTC_MERGE_REQUEST_ACTION_MERGE] = "merge",
 };
 
-void
-git_eventc_webhook_payload_parse_gitlab_merge_request(GitEventcEventBase *base, JsonObject *root)
+static void
+_git_eventc_webhook_payload_parse_gitlab_merge_request_send(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     JsonObject *mr = json_object_get_object_member(root, "object_attributes");
     const gchar *action_str = json_get_string_default(mr, "action", _git_eventc_webhook_gitlab_merge_request_action_name[GIT_EVENTC_MERGE_REQUEST_ACTION_OPENING]);
     guint64 action;
 
-    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_gitlab_merge_request_action_name, GIT_EVENTC_MERGE_REQUEST_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
-        return;
+    /* Already checked by the first step */
+    nk_enum_parse(action_str, _git_eventc_webhook_gitlab_merge_request_action_name, GIT_EVENTC_MERGE_REQUEST_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action);
 
     JsonObject *repository = json_object_get_object_member(root, "project");
     base->repository_name = json_object_get_string_member(repository, "name");
@@ -427,7 +445,7 @@ git_eventc_webhook_payload_parse_gitlab_merge_request(GitEventcEventBase *base,
     const gchar *branch = json_object_get_string_member(mr, "target_branch");
 
     JsonObject *user = json_object_get_object_member(root, "user");
-    JsonObject *author = _git_eventc_webhook_gitlab_get_user(base, repository, json_object_get_int_member(mr, "author_id"));
+    JsonObject *author = _git_eventc_webhook_gitlab_get_user(parse, "author");
 
     JsonArray *tags_array = json_object_get_array_member(root, "labels");
     guint length = json_array_get_length(tags_array);
@@ -464,6 +482,20 @@ git_eventc_webhook_payload_parse_gitlab_merge_request(GitEventcEventBase *base,
     g_free(namespace);
 }
 
+void
+git_eventc_webhook_payload_parse_gitlab_merge_request(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
+{
+    JsonObject *mr = json_object_get_object_member(root, "object_attributes");
+    const gchar *action_str = json_get_string_default(mr, "action", _git_eventc_webhook_gitlab_merge_request_action_name[GIT_EVENTC_MERGE_REQUEST_ACTION_OPENING]);
+    guint64 action;
+
+    if ( ! nk_enum_parse(action_str, _git_eventc_webhook_gitlab_merge_request_action_name, GIT_EVENTC_MERGE_REQUEST_NUM_ACTION, NK_ENUM_MATCH_FLAGS_IGNORE_CASE, &action) )
+        return;
+
+    _git_eventc_webhook_gitlab_fetch_user(parse, base, "author", json_object_get_object_member(root, "project"), json_object_get_int_member(mr, "author_id"));
+    git_eventc_webhook_parse_then(parse, _git_eventc_webhook_payload_parse_gitlab_merge_request_send);
+}
+
 static const gchar * const _git_eventc_webhook_gitlab_pipeline_state_name[] = {
     [GIT_EVENTC_CI_BUILD_ACTION_SUCCESS]  = "success",
     [GIT_EVENTC_CI_BUILD_ACTION_FAILURE]  = "failed",
@@ -471,7 +503,7 @@ static const gchar * const _git_eventc_webhook_gitlab_pipeline_state_name[] = {
 };
 
 void
-git_eventc_webhook_payload_parse_gitlab_pipeline(GitEventcEventBase *base, JsonObject *root)
+git_eventc_webhook_payload_parse_gitlab_pipeline(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     JsonObject *pipeline = json_object_get_object_member(root, "object_attributes");
     const gchar *state = json_object_get_string_member(pipeline, "status");
@@ -500,7 +532,7 @@ git_eventc_webhook_payload_parse_gitlab_pipeline(GitEventcEventBase *base, JsonO
 }
 
 void
-git_eventc_webhook_payload_parse_gitlab_system(GitEventcEventBase *base, JsonObject *root)
+git_eventc_webhook_payload_parse_gitlab_system(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     const gchar *event_name = json_get_string_safe(root, "event_name");
     if ( event_name == NULL )
@@ -513,5 +545,5 @@ git_eventc_webhook_payload_parse_gitlab_system(GitEventcEventBase *base, JsonObj
     if ( ! nk_enum_parse(event_name, git_eventc_webhook_gitlab_parsers_system_events, G_N_ELEMENTS(git_eventc_webhook_gitlab_parsers_system_events), NK_ENUM_MATCH_FLAGS_NONE, &event_type) )
         return;
 
-    git_eventc_webhook_gitlab_parsers[event_type](base, root);
+    git_eventc_webhook_gitlab_parsers[event_type](parse, base, root);
 }
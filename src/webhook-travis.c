@@ -32,6 +32,7 @@
 
 #include "nkutils-enum.h"
 #include "libgit-eventc.h"
+#include "webhook.h"
 #include "webhook-travis.h"
 
 static const gchar * const _git_eventc_webhook_travis_state_name[] = {
@@ -41,7 +42,7 @@ static const gchar * const _git_eventc_webhook_travis_state_name[] = {
 };
 
 void
-git_eventc_webhook_payload_parse_travis(GitEventcEventBase *base, JsonObject *root)
+git_eventc_webhook_payload_parse_travis(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root)
 {
     const gchar *state = json_object_get_string_member(root, "state");
     guint64 action;
@@ -56,20 +56,85 @@ typedef enum {
     GIT_EVENTC_WEBHOOK_SERVICE_TRAVIS,
 } GitEventcWebhookService;
 
+/*
+ * A delivery is parsed in steps: each step may start API fetches and
+ * queue the next step, which runs once all of them are done.
+ * The main loop is never blocked, so many deliveries are enriched at once.
+ * Deliveries of the same project wait for the previous ones though,
+ * so their events are sent in delivery order.
+ */
 typedef struct {
+    gchar *key;
+    GQueue parses;
+} GitEventcWebhookProject;
+
+struct _GitEventcWebhookParse {
     gchar **project;
     GVariant *extra_data;
     JsonParser *parser;
     GitEventcWebhookParseFunc func;
-} GitEventcWebhookParseData;
+    GHashTable *results;
+    guint pending;
+    GitEventcWebhookProject *queue;
+    GList link;
+};
+
+typedef struct {
+    GitEventcWebhookParse *parse;
+    gchar *name;
+    gchar *cache_key;
+    JsonNode *stale;
+    gchar *etag;
+} GitEventcWebhookParseFetch;
+
+typedef struct {
+    SoupMessage *msg;
+    gchar *url;
+} GitEventcWebhookApiGetData;
+
+/*
+ * Users profiles, most recently used first
+ * Stale entries are revalidated with their ETag
+ */
+typedef struct {
+    gchar *key;
+    JsonNode *node;
+    gchar *etag;
+    gint64 expires;
+    GList link;
+} GitEventcWebhookUserCacheEntry;
 
 typedef struct {
     gchar *name;
     gchar *value;
 } GitEventcWebhookHeader;
 
+/*
+ * Known tags of a repository, newest first, in a single ordering:
+ * either the push order (Gitlab gives them by update time),
+ * or the version order (GitHub gives them by name, we sort them
+ * ourselves with numbers compared by value)
+ * Seeded from the API, then kept up to date by the tag pushes themselves
+ * The previous tag is the one right after in this order
+ */
+typedef struct {
+    GitEventcWebhookTagsOrder order;
+    GQueue names;
+    gint64 synced;
+} GitEventcWebhookTagList;
+
 static GHashTable *secrets = NULL;
 static GHashTable *extra_headers = NULL;
+static gint _git_eventc_webhook_user_cache_size = 512;
+static gint _git_eventc_webhook_user_cache_ttl = 600;
+static GHashTable *_git_eventc_webhook_user_cache = NULL;
+static GQueue _git_eventc_webhook_user_cache_lru = G_QUEUE_INIT;
+static gint _git_eventc_webhook_tags_resync = 3600;
+static GHashTable *_git_eventc_webhook_tags = NULL;
+static GHashTable *_git_eventc_webhook_projects = NULL;
+static gint _git_eventc_webhook_max_pending = 1024;
+static guint _git_eventc_webhook_pending = 0;
+static guint _git_eventc_webhook_unanswered = 0;
 
 static void
 _git_eventc_webhook_header_free(gpointer data)
@@ -88,80 +153,246 @@ _git_eventc_webhook_headers_free(gpointer data)
     g_list_free_full(data, _git_eventc_webhook_header_free);
 }
 
-JsonNode *
-git_eventc_webhook_api_get(const GitEventcEventBase *base, const gchar *url)
+static GList *
+_git_eventc_webhook_get_extra_headers(const GitEventcEventBase *base)
 {
-    g_return_val_if_fail(url != NULL, NULL);
+    GList *headers = NULL;
+
+    if ( extra_headers == NULL )
+        return NULL;
 
+    if ( base->project[1] != NULL )
+        headers = g_hash_table_lookup(extra_headers, base->project[1]);
+    if ( headers == NULL )
+        headers = g_hash_table_lookup(extra_headers, base->project[0]);
+
+    return headers;
+}
+
+static SoupSession *
+_git_eventc_webhook_get_session(void)
+{
     static SoupSession *session = NULL;
-    GError *error = NULL;
 
     if ( session == NULL )
+        /* Fetches for concurrent deliveries mostly go to the same host */
+        session = soup_session_new_with_options(
+            "user-agent", PACKAGE_NAME " " PACKAGE_VERSION,
+            "max-conns-per-host", 8,
+            NULL);
+
+    return session;
+}
+
+static void
+_git_eventc_webhook_api_get_data_free(gpointer user_data)
+{
+    GitEventcWebhookApiGetData *data = user_data;
+
+    g_object_unref(data->msg);
+    g_free(data->url);
+
+    g_slice_free(GitEventcWebhookApiGetData, data);
+}
+
+static void
+_git_eventc_webhook_api_get_callback(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GTask *task = user_data;
+    GitEventcWebhookApiGetData *data = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    GBytes *bytes;
+    bytes = soup_session_send_and_read_finish(SOUP_SESSION(source_object), res, &error);
+    if ( bytes == NULL )
     {
-        session = soup_session_new();
-        soup_session_set_user_agent(session, PACKAGE_NAME " " PACKAGE_VERSION);
+        g_prefix_error(&error, "Error sending request to %s: ", data->url);
+        g_task_return_error(task, error);
+        goto end;
+    }
+
+    SoupStatus code = soup_message_get_status(data->msg);
+    if ( code == SOUP_STATUS_NOT_MODIFIED )
+    {
+        /* Only for conditional requests, the caller has the answer */
+        g_task_return_pointer(task, NULL, NULL);
+        g_bytes_unref(bytes);
+        goto end;
+    }
+    if ( code != SOUP_STATUS_OK )
+    {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "Couldn't get %s: %s", data->url, soup_status_get_phrase(code));
+        g_bytes_unref(bytes);
+        goto end;
+    }
+
+    JsonParser *parser;
+    gconstpointer body;
+    gsize length;
+    body = g_bytes_get_data(bytes, &length);
+    parser = json_parser_new();
+    if ( ! json_parser_load_from_data(parser, body, length, &error) )
+    {
+        g_prefix_error(&error, "Couldn't parse answer to %s: ", data->url);
+        g_task_return_error(task, error);
+    }
+    else
+    {
+        /* The parser tree is ours, no need to copy it */
+        JsonNode *root = json_parser_steal_root(parser);
+        if ( root != NULL )
+            g_task_return_pointer(task, root, (GDestroyNotify) json_node_unref);
+        else
+            g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Empty answer to %s", data->url);
+    }
+
+    g_object_unref(parser);
+    g_bytes_unref(bytes);
+
+end:
+    g_object_unref(task);
+}
+
+static void
+_git_eventc_webhook_api_get_async(const GitEventcEventBase *base, const gchar *url, const gchar *etag, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    GTask *task;
+    GError *error = NULL;
+
+    task = g_task_new(NULL, cancellable, callback, user_data);
+    g_task_set_source_tag(task, git_eventc_webhook_api_get_async);
+
+    if ( url == NULL )
+    {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "No URL to get");
+        g_object_unref(task);
+        return;
     }
 
     GUri *uri;
     uri = g_uri_parse(url, G_URI_FLAGS_HAS_PASSWORD, &error);
     if ( uri == NULL )
     {
-        g_warning("Couldn't parse URI %s: %s", url, error->message);
-        g_clear_error(&error);
-        return NULL;
+        g_prefix_error(&error, "Couldn't parse URI %s: ", url);
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
     }
 
-    SoupMessage *msg;
+    GitEventcWebhookApiGetData *data;
     SoupMessageHeaders *headers;
-    GList *header_ = NULL;
+    GList *header_;
 
-    msg = soup_message_new_from_uri(SOUP_METHOD_GET, uri);
-    headers = soup_message_get_request_headers(msg);
+    data = g_slice_new(GitEventcWebhookApiGetData);
+    data->msg = soup_message_new_from_uri(SOUP_METHOD_GET, uri);
+    data->url = g_strdup(url);
+    g_uri_unref(uri);
+    g_task_set_task_data(task, data, _git_eventc_webhook_api_get_data_free);
 
-    if ( base->project[1] != NULL )
-        header_ = g_hash_table_lookup(extra_headers, base->project[1]);
-    if ( header_ == NULL )
-        header_ = g_hash_table_lookup(extra_headers, base->project[0]);
-    for ( ; header_ != NULL ; header_ = g_list_next(header_) )
+    headers = soup_message_get_request_headers(data->msg);
+
+    for ( header_ = _git_eventc_webhook_get_extra_headers(base) ; header_ != NULL ; header_ = g_list_next(header_) )
     {
         GitEventcWebhookHeader *header = header_->data;
         soup_message_headers_append(headers, header->name, header->value);
     }
+    if ( etag != NULL )
+        soup_message_headers_replace(headers, "If-None-Match", etag);
 
-    GBytes *bytes;
-    bytes = soup_session_send_and_read(session, msg, NULL, &error);
-    if ( bytes == NULL )
+    soup_session_send_and_read_async(_git_eventc_webhook_get_session(), data->msg, G_PRIORITY_DEFAULT, cancellable, _git_eventc_webhook_api_get_callback, task);
+}
+
+void
+git_eventc_webhook_api_get_async(const GitEventcEventBase *base, const gchar *url, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+    _git_eventc_webhook_api_get_async(base, url, NULL, cancellable, callback, user_data);
+}
+
+JsonNode *
+git_eventc_webhook_api_get_finish(GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+static void
+_git_eventc_webhook_user_cache_entry_free(gpointer data)
+{
+    GitEventcWebhookUserCacheEntry *entry = data;
+
+    g_queue_unlink(&_git_eventc_webhook_user_cache_lru, &entry->link);
+    json_node_unref(entry->node);
+    g_free(entry->etag);
+    g_free(entry->key);
+
+    g_slice_free(GitEventcWebhookUserCacheEntry, entry);
+}
+
+/*
+ * Extra headers may carry different credentials, which may
+ * give different profiles (e.g. private emails), so they are part of the key
+ */
+static gchar *
+_git_eventc_webhook_user_cache_key(const GitEventcEventBase *base, const gchar *url)
+{
+    GString *key;
+    GList *header_;
+
+    key = g_string_new(url);
+    for ( header_ = _git_eventc_webhook_get_extra_headers(base) ; header_ != NULL ; header_ = g_list_next(header_) )
     {
-        g_warning("Error sending request to %s: %s", url, error->message);
-        g_clear_error(&error);
-        return NULL;
+        GitEventcWebhookHeader *header = header_->data;
+        g_string_append_printf(key, "\n%s: %s", header->name, header->value);
     }
 
-    SoupStatus code = soup_message_get_status(msg);
-    if ( code != SOUP_STATUS_OK )
-    {
-        g_warning("Couldn't get %s: %s", url, soup_status_get_phrase(code));
+    return g_string_free(key, FALSE);
+}
+
+static GitEventcWebhookUserCacheEntry *
+_git_eventc_webhook_user_cache_lookup(const gchar *key)
+{
+    GitEventcWebhookUserCacheEntry *entry;
+
+    if ( _git_eventc_webhook_user_cache == NULL )
         return NULL;
-    }
 
-    JsonParser *parser;
-    gpointer data;
-    gsize length;
-    data = g_bytes_unref_to_data(bytes, &length);
-    parser = json_parser_new();
-    if ( ! json_parser_load_from_data(parser, data, length, &error) )
-    {
-        g_warning("Couldn't parse answer to %s: %s", url, error->message);
-        g_clear_error(&error);
+    entry = g_hash_table_lookup(_git_eventc_webhook_user_cache, key);
+    if ( entry == NULL )
         return NULL;
-    }
 
-    JsonNode *node;
-    node = json_node_copy(json_parser_get_root(parser));
+    g_queue_unlink(&_git_eventc_webhook_user_cache_lru, &entry->link);
+    g_queue_push_head_link(&_git_eventc_webhook_user_cache_lru, &entry->link);
 
-    g_object_unref(parser);
+    return entry;
+}
+
+static void
+_git_eventc_webhook_user_cache_store(const gchar *key, JsonNode *node, const gchar *etag)
+{
+    GitEventcWebhookUserCacheEntry *entry;
 
-    return node;
+    if ( _git_eventc_webhook_user_cache_size <= 0 )
+        return;
+
+    if ( _git_eventc_webhook_user_cache == NULL )
+        _git_eventc_webhook_user_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _git_eventc_webhook_user_cache_entry_free);
+
+    entry = g_slice_new0(GitEventcWebhookUserCacheEntry);
+    entry->key = g_strdup(key);
+    entry->node = json_node_ref(node);
+    entry->etag = g_strdup(etag);
+    entry->expires = g_get_monotonic_time() + (gint64) _git_eventc_webhook_user_cache_ttl * G_USEC_PER_SEC;
+    entry->link.data = entry;
+
+    g_hash_table_replace(_git_eventc_webhook_user_cache, entry->key, entry);
+    g_queue_push_head_link(&_git_eventc_webhook_user_cache_lru, &entry->link);
+
+    while ( g_queue_get_length(&_git_eventc_webhook_user_cache_lru) > (guint) _git_eventc_webhook_user_cache_size )
+    {
+        GitEventcWebhookUserCacheEntry *last = g_queue_peek_tail(&_git_eventc_webhook_user_cache_lru);
+        g_hash_table_remove(_git_eventc_webhook_user_cache, last->key);
+    }
 }
 
 GList *
@@ -222,30 +453,535 @@ _git_eventc_webhook_extra_data_parsing(GHashTable *query)
     return NULL;
 }
 
-static gboolean
-_git_eventc_webhook_parse_callback(gpointer user_data)
+static void
+_git_eventc_webhook_parse_free(GitEventcWebhookParse *parse)
 {
-    GitEventcWebhookParseData *data = user_data;
-    GitEventcEventBase base = {
-        .project = (const gchar **) data->project,
-        .extra_data = data->extra_data,
-    };
+    if ( parse->results != NULL )
+        g_hash_table_unref(parse->results);
+    if ( parse->extra_data != NULL )
+        g_variant_unref(parse->extra_data);
+    g_strfreev(parse->project);
+    g_object_unref(parse->parser);
+
+    g_slice_free(GitEventcWebhookParse, parse);
+    --_git_eventc_webhook_pending;
+}
+
+static void
+_git_eventc_webhook_project_free(gpointer data)
+{
+    GitEventcWebhookProject *project = data;
+    GList *link;
+
+    /* Only left at exit, their fetches will never answer */
+    while ( ( link = g_queue_pop_head_link(&project->parses) ) != NULL )
+        _git_eventc_webhook_parse_free(link->data);
+    g_free(project->key);
+
+    g_slice_free(GitEventcWebhookProject, project);
+}
+
+/*
+ * Only the head of its project queue runs,
+ * it starts the next one when done
+ */
+static void
+_git_eventc_webhook_parse_run(GitEventcWebhookParse *parse)
+{
+    GitEventcWebhookProject *project = parse->queue;
+
+    do
+    {
+        JsonNode *root_node = json_parser_get_root(parse->parser);
+        JsonObject *root = json_node_get_object(root_node);
+
+        while ( ( parse->pending == 0 ) && ( parse->func != NULL ) )
+        {
+            GitEventcWebhookParseFunc func = parse->func;
+            GitEventcEventBase base = {
+                .project = (const gchar **) parse->project,
+                .extra_data = parse->extra_data,
+            };
+
+            parse->func = NULL;
+            func(parse, &base, root);
+        }
+
+        if ( parse->pending > 0 )
+            /* Waiting for API answers */
+            return;
+
+        g_queue_unlink(&project->parses, &parse->link);
+        _git_eventc_webhook_parse_free(parse);
+        parse = g_queue_peek_head(&project->parses);
+    } while ( parse != NULL );
+
+    g_hash_table_remove(_git_eventc_webhook_projects, project->key);
+}
+
+static void
+_git_eventc_webhook_parse_queue(GitEventcWebhookParse *parse)
+{
+    GitEventcWebhookProject *project;
+    gchar *key;
+
+    if ( _git_eventc_webhook_projects == NULL )
+        _git_eventc_webhook_projects = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, _git_eventc_webhook_project_free);
+
+    key = g_strjoinv("/", parse->project);
+    project = g_hash_table_lookup(_git_eventc_webhook_projects, key);
+    if ( project == NULL )
+    {
+        project = g_slice_new0(GitEventcWebhookProject);
+        project->key = key;
+        g_hash_table_insert(_git_eventc_webhook_projects, project->key, project);
+    }
+    else
+        g_free(key);
+
+    parse->queue = project;
+    parse->link.data = parse;
+    g_queue_push_tail_link(&project->parses, &parse->link);
+    if ( g_queue_get_length(&project->parses) == 1 )
+        _git_eventc_webhook_parse_run(parse);
+}
+
+static void
+_git_eventc_webhook_parse_fetch_callback(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GitEventcWebhookParseFetch *fetch = user_data;
+    GitEventcWebhookParse *parse = fetch->parse;
+    GError *error = NULL;
+    JsonNode *node;
+
+    node = git_eventc_webhook_api_get_finish(res, &error);
+    if ( fetch->cache_key != NULL )
+    {
+        if ( node != NULL )
+        {
+            GitEventcWebhookApiGetData *data = g_task_get_task_data(G_TASK(res));
+            _git_eventc_webhook_user_cache_store(fetch->cache_key, node, soup_message_headers_get_one(soup_message_get_response_headers(data->msg), "ETag"));
+        }
+        else if ( ( error == NULL ) && ( fetch->stale != NULL ) )
+        {
+            /* Not modified, our entry may have been evicted meanwhile */
+            node = json_node_ref(fetch->stale);
+            _git_eventc_webhook_user_cache_store(fetch->cache_key, node, fetch->etag);
+        }
+        if ( fetch->stale != NULL )
+            json_node_unref(fetch->stale);
+        g_free(fetch->etag);
+        g_free(fetch->cache_key);
+    }
+
+    if ( node != NULL )
+        g_hash_table_insert(parse->results, fetch->name, node);
+    else
+    {
+        if ( error != NULL )
+            g_warning("%s", error->message);
+        g_clear_error(&error);
+        g_free(fetch->name);
+    }
+    g_slice_free(GitEventcWebhookParseFetch, fetch);
+
+    --parse->pending;
+    _git_eventc_webhook_parse_run(parse);
+}
+
+void
+git_eventc_webhook_parse_fetch(GitEventcWebhookParse *parse, const GitEventcEventBase *base, const gchar *name, const gchar *url)
+{
+    GitEventcWebhookParseFetch *fetch;
+
+    if ( parse->results == NULL )
+        parse->results = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) json_node_unref);
+
+    fetch = g_slice_new0(GitEventcWebhookParseFetch);
+    fetch->parse = parse;
+    fetch->name = g_strdup(name);
+
+    ++parse->pending;
+    git_eventc_webhook_api_get_async(base, url, NULL, _git_eventc_webhook_parse_fetch_callback, fetch);
+}
+
+void
+git_eventc_webhook_parse_fetch_user(GitEventcWebhookParse *parse, const GitEventcEventBase *base, const gchar *name, const gchar *url)
+{
+    GitEventcWebhookUserCacheEntry *entry;
+    GitEventcWebhookParseFetch *fetch;
+    gchar *key;
+
+    if ( url == NULL )
+        return;
+
+    if ( parse->results == NULL )
+        parse->results = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) json_node_unref);
+
+    key = _git_eventc_webhook_user_cache_key(base, url);
+    entry = _git_eventc_webhook_user_cache_lookup(key);
+    if ( ( entry != NULL ) && ( entry->expires > g_get_monotonic_time() ) )
+    {
+        g_hash_table_insert(parse->results, g_strdup(name), json_node_ref(entry->node));
+        g_free(key);
+        return;
+    }
+
+    fetch = g_slice_new0(GitEventcWebhookParseFetch);
+    fetch->parse = parse;
+    fetch->name = g_strdup(name);
+    fetch->cache_key = key;
+    if ( ( entry != NULL ) && ( entry->etag != NULL ) )
+    {
+        /* Keep what the 304 answer refers to */
+        fetch->stale = json_node_ref(entry->node);
+        fetch->etag = g_strdup(entry->etag);
+    }
+
+    ++parse->pending;
+    _git_eventc_webhook_api_get_async(base, url, fetch->etag, NULL, _git_eventc_webhook_parse_fetch_callback, fetch);
+}
+
+static void
+_git_eventc_webhook_tag_list_free(gpointer data)
+{
+    GitEventcWebhookTagList *list = data;
+
+    g_queue_clear_full(&list->names, g_free);
+
+    g_slice_free(GitEventcWebhookTagList, list);
+}
+
+void
+git_eventc_webhook_parse_fetch_tags(GitEventcWebhookParse *parse, const GitEventcEventBase *base, const gchar *repository, const gchar *url)
+{
+    GitEventcWebhookTagList *list = NULL;
+
+    if ( _git_eventc_webhook_tags != NULL )
+        list = g_hash_table_lookup(_git_eventc_webhook_tags, repository);
+    /* Deletions may leave us without a previous tag */
+    if ( ( list != NULL ) && ( g_queue_get_length(&list->names) >= 2 ) && ( g_get_monotonic_time() < list->synced + (gint64) _git_eventc_webhook_tags_resync * G_USEC_PER_SEC ) )
+        return;
+
+    git_eventc_webhook_parse_fetch(parse, base, "tags", url);
+}
+
+static gint
+_git_eventc_webhook_tag_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    gchar *ka, *kb;
+    gint ret;
+
+    /* Newest first */
+    ka = g_utf8_collate_key_for_filename(a, -1);
+    kb = g_utf8_collate_key_for_filename(b, -1);
+    ret = strcmp(kb, ka);
+    g_free(kb);
+    g_free(ka);
+
+    return ret;
+}
+
+static void
+_git_eventc_webhook_tag_list_insert(GitEventcWebhookTagList *list, const gchar *tag)
+{
+    GList *link;
+
+    if ( list->order == GIT_EVENTC_WEBHOOK_TAGS_ORDER_PUSH )
+    {
+        g_queue_push_head(&list->names, g_strdup(tag));
+        return;
+    }
+
+    for ( link = list->names.head ; link != NULL ; link = g_list_next(link) )
+    {
+        if ( _git_eventc_webhook_tag_compare(tag, link->data, NULL) < 0 )
+            break;
+    }
+    if ( link != NULL )
+        g_queue_insert_before(&list->names, link, g_strdup(tag));
+    else
+        g_queue_push_tail(&list->names, g_strdup(tag));
+}
+
+/*
+ * Returns the tag before this one, if any
+ */
+const gchar *
+git_eventc_webhook_parse_update_tags(GitEventcWebhookParse *parse, const gchar *repository, GitEventcWebhookTagsOrder order, const gchar *tag, gboolean deleted)
+{
+    GitEventcWebhookTagList *list = NULL;
+    JsonNode *node;
+    GList *link;
+
+    if ( repository == NULL )
+        return NULL;
 
-    JsonNode *root_node = json_parser_get_root(data->parser);
-    JsonObject *root = json_node_get_object(root_node);
+    if ( _git_eventc_webhook_tags == NULL )
+        _git_eventc_webhook_tags = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _git_eventc_webhook_tag_list_free);
+    list = g_hash_table_lookup(_git_eventc_webhook_tags, repository);
 
-    data->func(&base, root);
+    node = git_eventc_webhook_parse_get_result(parse, "tags");
+    if ( ( node != NULL ) && JSON_NODE_HOLDS_ARRAY(node) )
+    {
+        JsonArray *tags = json_node_get_array(node);
+        guint i, length = MIN(json_array_get_length(tags), GIT_EVENTC_WEBHOOK_TAGS_MAX);
+
+        if ( list == NULL )
+        {
+            list = g_slice_new0(GitEventcWebhookTagList);
+            g_hash_table_insert(_git_eventc_webhook_tags, g_strdup(repository), list);
+        }
+        list->order = order;
+        g_queue_clear_full(&list->names, g_free);
+        for ( i = 0 ; i < length ; ++i )
+        {
+            JsonObject *object = json_array_get_object_element(tags, i);
+            if ( ( object != NULL ) && json_object_has_member(object, "name") )
+                g_queue_push_tail(&list->names, g_strdup(json_object_get_string_member(object, "name")));
+        }
+        if ( list->order == GIT_EVENTC_WEBHOOK_TAGS_ORDER_VERSION )
+            g_queue_sort(&list->names, _git_eventc_webhook_tag_compare, NULL);
+        list->synced = g_get_monotonic_time();
+    }
 
-    if ( data->extra_data != NULL )
-        g_variant_unref(data->extra_data);
-    g_strfreev(data->project);
-    g_object_unref(data->parser);
+    if ( list == NULL )
+        /* Never fetched, nothing to update */
+        return NULL;
 
-    g_slice_free(GitEventcWebhookParseData, data);
+    link = g_queue_find_custom(&list->names, tag, (GCompareFunc) g_strcmp0);
+    if ( deleted )
+    {
+        if ( link != NULL )
+        {
+            g_free(link->data);
+            g_queue_delete_link(&list->names, link);
+        }
+        return NULL;
+    }
+
+    if ( link == NULL )
+    {
+        _git_eventc_webhook_tag_list_insert(list, tag);
+        if ( g_queue_get_length(&list->names) > GIT_EVENTC_WEBHOOK_TAGS_MAX )
+            g_free(g_queue_pop_tail(&list->names));
+        link = g_queue_find_custom(&list->names, tag, (GCompareFunc) g_strcmp0);
+    }
+    else if ( ( list->order == GIT_EVENTC_WEBHOOK_TAGS_ORDER_PUSH ) && ( link != list->names.head ) )
+    {
+        /* Pushed again, it is the newest now */
+        g_queue_unlink(&list->names, link);
+        g_queue_push_head_link(&list->names, link);
+    }
+
+    if ( ( link == NULL ) || ( link->next == NULL ) )
+        /* Older than all we know */
+        return NULL;
+    return link->next->data;
+}
+
+JsonNode *
+git_eventc_webhook_parse_get_result(GitEventcWebhookParse *parse, const gchar *name)
+{
+    if ( parse->results == NULL )
+        return NULL;
+    return g_hash_table_lookup(parse->results, name);
+}
+
+void
+git_eventc_webhook_parse_then(GitEventcWebhookParse *parse, GitEventcWebhookParseFunc func)
+{
+    parse->func = func;
+}
+
+/*
+ * Signature verification and payload parsing run in a thread pool,
+ * the message is paused meanwhile and answered back on the main loop.
+ * Workers never touch the message itself, only what we copied here.
+ */
+typedef struct {
+    SoupServerMessage *msg;
+    GitEventcWebhookService service;
+    gchar *user_agent;
+    gchar *content_type;
+    gchar *event;
+    gchar *secret;
+    gchar *signature;
+    GBytes *body;
+    gchar **project;
+    GVariant *extra_data;
+    guint status_code;
+    JsonParser *parser;
+    GitEventcWebhookParseFunc func;
+} GitEventcWebhookDelivery;
+
+static GThreadPool *_git_eventc_webhook_pool = NULL;
+static gint _git_eventc_webhook_jobs = 0;
+
+static void
+_git_eventc_webhook_delivery_free(GitEventcWebhookDelivery *delivery)
+{
+    if ( delivery->parser != NULL )
+        g_object_unref(delivery->parser);
+    if ( delivery->extra_data != NULL )
+        g_variant_unref(delivery->extra_data);
+    g_strfreev(delivery->project);
+    g_bytes_unref(delivery->body);
+    g_free(delivery->signature);
+    g_free(delivery->secret);
+    g_free(delivery->event);
+    g_free(delivery->content_type);
+    g_free(delivery->user_agent);
+    g_object_unref(delivery->msg);
+
+    g_slice_free(GitEventcWebhookDelivery, delivery);
+}
+
+static gboolean
+_git_eventc_webhook_delivery_done(gpointer user_data)
+{
+    GitEventcWebhookDelivery *delivery = user_data;
+
+    soup_server_message_set_status(delivery->msg, delivery->status_code, soup_status_get_phrase(delivery->status_code));
+    soup_server_message_unpause(delivery->msg);
+    --_git_eventc_webhook_unanswered;
+
+    if ( ( delivery->parser != NULL ) && ( delivery->func != NULL ) )
+    {
+        GitEventcWebhookParse parse_data = {
+            .project = delivery->project,
+            .extra_data = delivery->extra_data,
+            .parser = delivery->parser,
+            .func = delivery->func,
+        };
+        delivery->project = NULL;
+        delivery->extra_data = NULL;
+        delivery->parser = NULL;
+        _git_eventc_webhook_parse_queue(g_slice_dup(GitEventcWebhookParse, &parse_data));
+    }
+    else
+        --_git_eventc_webhook_pending;
+
+    _git_eventc_webhook_delivery_free(delivery);
 
     return FALSE;
 }
 
+static guint
+_git_eventc_webhook_delivery_process(GitEventcWebhookDelivery *delivery)
+{
+    GHashTable *data = NULL;
+    guint status_code;
+
+    if ( delivery->signature != NULL )
+    {
+        GHmac *hmac;
+        gconstpointer body;
+        gsize length;
+        gboolean match;
+
+        body = g_bytes_get_data(delivery->body, &length);
+        hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *) delivery->secret, strlen(delivery->secret));
+        g_hmac_update(hmac, body, length);
+        match = ( g_ascii_strcasecmp(delivery->signature, g_hmac_get_string(hmac)) == 0 );
+        if ( ! match )
+            g_warning("Signature of request from %s does not match %s != %s", delivery->user_agent, delivery->signature, g_hmac_get_string(hmac));
+        g_hmac_unref(hmac);
+        if ( ! match )
+            return SOUP_STATUS_UNAUTHORIZED;
+    }
+
+    status_code = SOUP_STATUS_BAD_REQUEST;
+    const gchar *payload = NULL;
+    if ( g_strcmp0(delivery->content_type, "application/json") == 0 )
+        payload = g_bytes_get_data(delivery->body, NULL);
+    else if ( g_strcmp0(delivery->content_type, "application/x-www-form-urlencoded") == 0 )
+    {
+        data = soup_form_decode(g_bytes_get_data(delivery->body, NULL));
+
+        if ( data == NULL )
+        {
+            g_warning("Bad POST from %s: no data", delivery->user_agent);
+            goto cleanup;
+        }
+        payload = g_hash_table_lookup(data, "payload");
+    }
+
+    if ( payload == NULL )
+    {
+        g_warning("Bad POST from %s: no payload", delivery->user_agent);
+        goto cleanup;
+    }
+    JsonParser *parser = json_parser_new();
+
+    GError *error = NULL;
+    if ( ! json_parser_load_from_data(parser, payload, -1, &error) )
+    {
+        g_warning("Could not parse JSON: %s", error->message);
+        g_clear_error(&error);
+        g_object_unref(parser);
+        goto cleanup;
+    }
+
+    JsonNode *root = json_parser_get_root(parser);
+    if ( root == NULL )
+    {
+        g_warning("Bad POST from %s: Empty payload", delivery->user_agent);
+        g_object_unref(parser);
+        goto cleanup;
+    }
+
+    status_code = SOUP_STATUS_NOT_IMPLEMENTED;
+    switch ( delivery->service )
+    {
+    case GIT_EVENTC_WEBHOOK_SERVICE_GITHUB:
+    {
+        guint64 webhook_type;
+        if ( nk_enum_parse(delivery->event, git_eventc_webhook_github_parsers_events, _GIT_EVENTC_WEBHOOK_GITHUB_PARSER_SIZE, NK_ENUM_MATCH_FLAGS_NONE, &webhook_type) )
+        {
+            delivery->func = git_eventc_webhook_github_parsers[webhook_type];
+            status_code = SOUP_STATUS_OK;
+        }
+    }
+    break;
+    case GIT_EVENTC_WEBHOOK_SERVICE_GITLAB:
+    {
+        guint64 webhook_type;
+        if ( nk_enum_parse(delivery->event, git_eventc_webhook_gitlab_parsers_events, _GIT_EVENTC_WEBHOOK_GITLAB_PARSER_SIZE, NK_ENUM_MATCH_FLAGS_NONE, &webhook_type) )
+        {
+            delivery->func = git_eventc_webhook_gitlab_parsers[webhook_type];
+            status_code = SOUP_STATUS_OK;
+        }
+    }
+    break;
+    case GIT_EVENTC_WEBHOOK_SERVICE_TRAVIS:
+        delivery->func = git_eventc_webhook_payload_parse_travis;
+        status_code = SOUP_STATUS_OK;
+    break;
+    case GIT_EVENTC_WEBHOOK_SERVICE_UNKNOWN:
+        g_return_val_if_reached(SOUP_STATUS_INTERNAL_SERVER_ERROR);
+    }
+
+    if ( delivery->func != NULL )
+        delivery->parser = parser;
+    else
+        g_object_unref(parser);
+
+cleanup:
+    if ( data != NULL )
+        g_hash_table_unref(data);
+    return status_code;
+}
+
+static void
+_git_eventc_webhook_delivery_thread(gpointer data, gpointer user_data)
+{
+    GitEventcWebhookDelivery *delivery = data;
+
+    delivery->status_code = _git_eventc_webhook_delivery_process(delivery);
+    g_idle_add(_git_eventc_webhook_delivery_done, delivery);
+}
+
 static void
 _git_eventc_webhook_gateway_server_callback(SoupServer *server, SoupServerMessage *msg, const char *path, GHashTable *query, gpointer user_data)
 {
@@ -255,8 +991,7 @@ _git_eventc_webhook_gateway_server_callback(SoupServer *server, SoupServerMessag
         user_agent = "";
 
     gchar **project = NULL;
-    GHmac *hmac = NULL;
-    GHashTable *data = NULL;
+    const gchar *github_secret = NULL, *github_signature = NULL;
 
     guint status_code = SOUP_STATUS_NOT_IMPLEMENTED;
 
@@ -283,11 +1018,15 @@ _git_eventc_webhook_gateway_server_callback(SoupServer *server, SoupServerMessag
     }
 
     GitEventcWebhookService service = GIT_EVENTC_WEBHOOK_SERVICE_UNKNOWN;
+    const gchar *event = NULL;
     if ( g_str_has_prefix(user_agent, "GitHub-Hookshot/") )
+    {
         service = GIT_EVENTC_WEBHOOK_SERVICE_GITHUB;
+        event = soup_message_headers_get_one(headers, "X-GitHub-Event");
+    }
     else if ( g_str_has_prefix(user_agent, "Travis CI ") )
         service = GIT_EVENTC_WEBHOOK_SERVICE_TRAVIS;
-    else if ( soup_message_headers_get_one(headers, "X-Gitlab-Event") != NULL )
+    else if ( ( event = soup_message_headers_get_one(headers, "X-Gitlab-Event") ) != NULL )
         service = GIT_EVENTC_WEBHOOK_SERVICE_GITLAB;
     else
     {
@@ -295,8 +1034,6 @@ _git_eventc_webhook_gateway_server_callback(SoupServer *server, SoupServerMessag
         goto cleanup;
     }
 
-    SoupMessageBody *body = soup_server_message_get_request_body(msg);
-
     if ( secrets != NULL )
     {
         status_code = SOUP_STATUS_UNAUTHORIZED;
@@ -333,16 +1070,10 @@ _git_eventc_webhook_gateway_server_callback(SoupServer *server, SoupServerMessag
                     g_warning("Signature of request from %s does not match", user_agent);
                     goto cleanup;
                 }
-                signature += strlen("sha1=");
 
-                hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *) secret, strlen(secret));
-                g_hmac_update(hmac, (const guchar *) body->data, body->length);
-
-                if ( g_ascii_strcasecmp(signature, g_hmac_get_string(hmac)) != 0 )
-                {
-                    g_warning("Signature of request from %s does not match %s != %s", user_agent, signature, g_hmac_get_string(hmac));
-                    goto cleanup;
-                }
+                /* Checked in a worker thread */
+                github_secret = secret;
+                github_signature = signature + strlen("sha1=");
             }
             break;
             case GIT_EVENTC_WEBHOOK_SERVICE_GITLAB:
@@ -385,97 +1116,37 @@ _git_eventc_webhook_gateway_server_callback(SoupServer *server, SoupServerMessag
         }
     }
 
-    status_code = SOUP_STATUS_BAD_REQUEST;
-    const gchar *payload = NULL;
-    if ( g_strcmp0(content_type, "application/json") == 0 )
-        payload = body->data;
-    else if ( g_strcmp0(content_type, "application/x-www-form-urlencoded") == 0 )
-    {
-        data = soup_form_decode(body->data);
-
-        if ( data == NULL )
-        {
-            g_warning("Bad POST from %s: no data", user_agent);
-            goto cleanup;
-        }
-        payload = g_hash_table_lookup(data, "payload");
-    }
-
-    if ( payload == NULL )
-    {
-        g_warning("Bad POST from %s: no payload", user_agent);
-        goto cleanup;
-    }
-    JsonParser *parser = json_parser_new();
-
-    GError *error = NULL;
-    if ( ! json_parser_load_from_data(parser, payload, -1, &error) )
+    /* Counting both the pool queue and the projects ones, no pool when exiting */
+    if ( ( _git_eventc_webhook_pool == NULL ) || ( _git_eventc_webhook_pending >= (guint) _git_eventc_webhook_max_pending ) )
     {
-        g_warning("Could not parse JSON: %s", error->message);
-        g_clear_error(&error);
+        /* The hosting service will retry */
+        status_code = SOUP_STATUS_SERVICE_UNAVAILABLE;
+        g_warning("Too many deliveries waiting, refusing the one from %s", user_agent);
         goto cleanup;
     }
 
-    JsonNode *root = json_parser_get_root(parser);
-    if ( root == NULL )
-    {
-        g_warning("Bad POST from %s: Empty payload", user_agent);
-        goto cleanup;
-    }
-
-    GitEventcWebhookParseData parse_data = {
-        .project = project,
-        .parser = parser,
-    };
-
-    status_code = SOUP_STATUS_NOT_IMPLEMENTED;
-    switch ( service )
-    {
-    case GIT_EVENTC_WEBHOOK_SERVICE_GITHUB:
-    {
-        const gchar *event = soup_message_headers_get_one(headers, "X-GitHub-Event");
-        guint64 webhook_type;
-        if ( nk_enum_parse(event, git_eventc_webhook_github_parsers_events, _GIT_EVENTC_WEBHOOK_GITHUB_PARSER_SIZE, NK_ENUM_MATCH_FLAGS_NONE, &webhook_type) )
-        {
-            parse_data.func = git_eventc_webhook_github_parsers[webhook_type];
-            status_code = SOUP_STATUS_OK;
-        }
-
-    }
-    break;
-    case GIT_EVENTC_WEBHOOK_SERVICE_GITLAB:
-    {
-        const gchar *event = soup_message_headers_get_one(headers, "X-Gitlab-Event");
-        guint64 webhook_type;
-        if ( nk_enum_parse(event, git_eventc_webhook_gitlab_parsers_events, _GIT_EVENTC_WEBHOOK_GITLAB_PARSER_SIZE, NK_ENUM_MATCH_FLAGS_NONE, &webhook_type) )
-        {
-            parse_data.func = git_eventc_webhook_gitlab_parsers[webhook_type];
-            status_code = SOUP_STATUS_OK;
-        }
-    }
-    break;
-    case GIT_EVENTC_WEBHOOK_SERVICE_TRAVIS:
-        parse_data.func = git_eventc_webhook_payload_parse_travis;
-        status_code = SOUP_STATUS_OK;
-    break;
-    case GIT_EVENTC_WEBHOOK_SERVICE_UNKNOWN:
-        g_return_if_reached();
-    }
-
-    if ( parse_data.func != NULL )
-    {
-        project = NULL;
-        parse_data.extra_data = _git_eventc_webhook_extra_data_parsing(query);
-        g_idle_add(_git_eventc_webhook_parse_callback, g_slice_dup(GitEventcWebhookParseData, &parse_data));
-    }
-    else
-        g_object_unref(parser);
+    GitEventcWebhookDelivery *delivery;
+
+    delivery = g_slice_new0(GitEventcWebhookDelivery);
+    delivery->msg = g_object_ref(msg);
+    delivery->service = service;
+    delivery->user_agent = g_strdup(user_agent);
+    delivery->content_type = g_strdup(content_type);
+    delivery->event = g_strdup(event);
+    delivery->secret = g_strdup(github_secret);
+    delivery->signature = g_strdup(github_signature);
+    /* Already complete, it stays valid without the message */
+    delivery->body = soup_message_body_flatten(soup_server_message_get_request_body(msg));
+    delivery->project = project;
+    delivery->extra_data = _git_eventc_webhook_extra_data_parsing(query);
+
+    ++_git_eventc_webhook_pending;
+    ++_git_eventc_webhook_unanswered;
+    soup_server_message_pause(msg);
+    g_thread_pool_push(_git_eventc_webhook_pool, delivery, NULL);
+    return;
 
 cleanup:
-    if ( data != NULL )
-        g_hash_table_unref(data);
-    if ( hmac != NULL )
-        g_hmac_unref(hmac);
     g_strfreev(project);
     soup_server_message_set_status(msg, status_code, soup_status_get_phrase(status_code));
 }
@@ -666,9 +1337,14 @@ main(int argc, char *argv[])
 
     GOptionEntry entries[] =
     {
-        { "port",           'p', 0, G_OPTION_ARG_INT,      &port,           "Port to listen to (defaults to 0, random" SYSTEMD_SOCKETS_HELP ")", "<port>" },
-        { "cert-file",      'c', 0, G_OPTION_ARG_FILENAME, &tls_cert_file,  "Path to the certificate file",                                      "<path>" },
-        { "key-file",       'k', 0, G_OPTION_ARG_FILENAME, &tls_key_file,   "Path to the key file (defaults to cert-file)",                      "<path>" },
+        { "port",            'p', 0, G_OPTION_ARG_INT,      &port,                                "Port to listen to (defaults to 0, random" SYSTEMD_SOCKETS_HELP ")", "<port>" },
+        { "cert-file",       'c', 0, G_OPTION_ARG_FILENAME, &tls_cert_file,                       "Path to the certificate file",                                      "<path>" },
+        { "key-file",        'k', 0, G_OPTION_ARG_FILENAME, &tls_key_file,                        "Path to the key file (defaults to cert-file)",                      "<path>" },
+        { "user-cache-size", 0,   0, G_OPTION_ARG_INT,      &_git_eventc_webhook_user_cache_size, "Number of API user profiles to keep (defaults to 512, 0 to disable)", "<users>" },
+        { "user-cache-ttl",  0,   0, G_OPTION_ARG_INT,      &_git_eventc_webhook_user_cache_ttl,  "Time before revalidating a user profile, in seconds (defaults to 600)", "<seconds>" },
+        { "tags-resync",     0,   0, G_OPTION_ARG_INT,      &_git_eventc_webhook_tags_resync,     "Time before fetching a repository tags list again, in seconds (defaults to 3600)", "<seconds>" },
+        { "jobs",            'j', 0, G_OPTION_ARG_INT,      &_git_eventc_webhook_jobs,            "Number of threads verifying and parsing deliveries (defaults to 0, one per processor)", "<threads>" },
+        { "max-pending",     0,   0, G_OPTION_ARG_INT,      &_git_eventc_webhook_max_pending,     "Number of deliveries waiting for their events to be sent before refusing new ones (defaults to 1024)", "<deliveries>" },
         { NULL }
     };
 
@@ -684,6 +1360,10 @@ main(int argc, char *argv[])
     GMainLoop *loop;
     loop = g_main_loop_new(NULL, FALSE);
 
+    if ( _git_eventc_webhook_jobs < 1 )
+        _git_eventc_webhook_jobs = g_get_num_processors();
+    _git_eventc_webhook_pool = g_thread_pool_new(_git_eventc_webhook_delivery_thread, NULL, _git_eventc_webhook_jobs, FALSE, NULL);
+
     if ( git_eventc_init(loop, &retval) )
     {
         SoupServer *server;
@@ -691,6 +1371,25 @@ main(int argc, char *argv[])
         if ( server != NULL )
         {
             g_main_loop_run(loop);
+
+            /*
+             * Stop accepting connections but keep the clients ones,
+             * let the workers finish what they have, answer these
+             * deliveries, and only then close
+             */
+            GSList *listeners, *listener;
+            listeners = soup_server_get_listeners(server);
+            for ( listener = listeners ; listener != NULL ; listener = g_slist_next(listener) )
+                g_socket_close(listener->data, NULL);
+            g_slist_free(listeners);
+
+            g_thread_pool_free(_git_eventc_webhook_pool, FALSE, TRUE);
+            _git_eventc_webhook_pool = NULL;
+            while ( _git_eventc_webhook_unanswered > 0 )
+                g_main_context_iteration(NULL, TRUE);
+            while ( g_main_context_iteration(NULL, FALSE) );
+
+            soup_server_disconnect(server);
             g_object_unref(server);
             retval = 0;
         }
@@ -699,9 +1398,17 @@ main(int argc, char *argv[])
     }
     else
         retval = 2;
+    if ( _git_eventc_webhook_pool != NULL )
+        g_thread_pool_free(_git_eventc_webhook_pool, TRUE, TRUE);
     g_main_loop_unref(loop);
 
 end:
+    if ( _git_eventc_webhook_projects != NULL )
+        g_hash_table_unref(_git_eventc_webhook_projects);
+    if ( _git_eventc_webhook_tags != NULL )
+        g_hash_table_unref(_git_eventc_webhook_tags);
+    if ( _git_eventc_webhook_user_cache != NULL )
+        g_hash_table_unref(_git_eventc_webhook_user_cache);
     git_eventc_uninit();
     g_free(tls_key_file);
     g_free(tls_cert_file);
@@ -23,9 +23,26 @@
 #ifndef __GIT_EVENTC_WEBHOOK_H__
 #define __GIT_EVENTC_WEBHOOK_H__
 
-typedef void (*GitEventcWebhookParseFunc)(GitEventcEventBase *base, JsonObject *root);
+typedef struct _GitEventcWebhookParse GitEventcWebhookParse;
+typedef enum {
+    GIT_EVENTC_WEBHOOK_TAGS_ORDER_PUSH,
+    GIT_EVENTC_WEBHOOK_TAGS_ORDER_VERSION,
+} GitEventcWebhookTagsOrder;
 
-JsonNode *git_eventc_webhook_api_get(const GitEventcEventBase *base, const gchar *url);
+/* Also the page size when fetching them, the most GitHub gives at once */
+#define GIT_EVENTC_WEBHOOK_TAGS_MAX 100
+typedef void (*GitEventcWebhookParseFunc)(GitEventcWebhookParse *parse, GitEventcEventBase *base, JsonObject *root);
+typedef void (*GitEventcWebhookParseFetchFunc)(GitEventcWebhookParse *parse, const GitEventcEventBase *base, const gchar *name, const gchar *url);
+
+void git_eventc_webhook_api_get_async(const GitEventcEventBase *base, const gchar *url, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+JsonNode *git_eventc_webhook_api_get_finish(GAsyncResult *result, GError **error);
+
+void git_eventc_webhook_parse_fetch(GitEventcWebhookParse *parse, const GitEventcEventBase *base, const gchar *name, const gchar *url);
+void git_eventc_webhook_parse_fetch_user(GitEventcWebhookParse *parse, const GitEventcEventBase *base, const gchar *name, const gchar *url);
+void git_eventc_webhook_parse_fetch_tags(GitEventcWebhookParse *parse, const GitEventcEventBase *base, const gchar *repository, const gchar *url);
+const gchar *git_eventc_webhook_parse_update_tags(GitEventcWebhookParse *parse, const gchar *repository, GitEventcWebhookTagsOrder order, const gchar *tag, gboolean deleted);
+JsonNode *git_eventc_webhook_parse_get_result(GitEventcWebhookParse *parse, const gchar *name);
+void git_eventc_webhook_parse_then(GitEventcWebhookParse *parse, GitEventcWebhookParseFunc func);
 GList *git_eventc_webhook_node_list_to_string_list(GList *list);
 
 #define json_get_string_safe(object, member) (( ( object != NULL ) && json_object_has_member(object, member) ) ? json_object_get_string_member(object, member) : NULL)
@@ -0,0 +1,345 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <git2.h>
+
+#include "post-receive-cache.h"
+
+#define CACHE_KEY "test"
+#define CACHE_MAX_SIZE (64 * 1024)
+
+typedef struct {
+    gchar *directory;
+    gchar *path;
+    GitEventcPostReceiveCache *cache;
+} GitEventcTestCacheFixture;
+
+static void
+_test_cache_setup(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    GError *error = NULL;
+
+    fixture->directory = g_dir_make_tmp("git-eventc-cache-XXXXXX", &error);
+    g_assert_no_error(error);
+    fixture->path = g_build_filename(fixture->directory, "files-" CACHE_KEY ".cache", NULL);
+    fixture->cache = git_eventc_post_receive_cache_new(fixture->directory, CACHE_KEY, GPOINTER_TO_SIZE(user_data));
+    g_assert_nonnull(fixture->cache);
+}
+
+static void
+_test_cache_teardown(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    git_eventc_post_receive_cache_free(fixture->cache);
+    g_unlink(fixture->path);
+    g_rmdir(fixture->directory);
+    g_free(fixture->path);
+    g_free(fixture->directory);
+}
+
+static void
+_test_cache_reopen(GitEventcTestCacheFixture *fixture, gsize max_size)
+{
+    git_eventc_post_receive_cache_free(fixture->cache);
+    fixture->cache = git_eventc_post_receive_cache_new(fixture->directory, CACHE_KEY, max_size);
+    g_assert_nonnull(fixture->cache);
+}
+
+static void
+_test_cache_id(git_oid *id, guint n)
+{
+    gchar hex[GIT_OID_HEXSZ + 1];
+
+    g_snprintf(hex, sizeof(hex), "%0*x", GIT_OID_HEXSZ, n);
+    g_assert_cmpint(git_oid_fromstr(id, hex), ==, 0);
+}
+
+static gsize
+_test_cache_size(GitEventcTestCacheFixture *fixture)
+{
+    GStatBuf st;
+
+    g_assert_cmpint(g_stat(fixture->path, &st), ==, 0);
+    return st.st_size;
+}
+
+static void
+_test_cache_assert_found(GitEventcTestCacheFixture *fixture, guint n, const gchar *files, guint32 flags)
+{
+    git_oid id;
+    gchar *found_files = NULL;
+    guint32 found_flags = 0;
+
+    _test_cache_id(&id, n);
+    g_assert_true(git_eventc_post_receive_cache_lookup(fixture->cache, &id, &found_files, &found_flags));
+    g_assert_cmpstr(found_files, ==, files);
+    g_assert_cmpuint(found_flags, ==, flags);
+    g_free(found_files);
+}
+
+static void
+_test_cache_assert_missing(GitEventcTestCacheFixture *fixture, guint n)
+{
+    git_oid id;
+    gchar *found_files = NULL;
+    guint32 found_flags = 0;
+
+    _test_cache_id(&id, n);
+    g_assert_false(git_eventc_post_receive_cache_lookup(fixture->cache, &id, &found_files, &found_flags));
+}
+
+static void
+_test_cache_store(GitEventcTestCacheFixture *fixture, guint n, const gchar *files, guint32 flags)
+{
+    git_oid id;
+
+    _test_cache_id(&id, n);
+    git_eventc_post_receive_cache_store(fixture->cache, &id, files, flags);
+}
+
+static void
+_test_cache_corrupt(GitEventcTestCacheFixture *fixture, gsize offset)
+{
+    GError *error = NULL;
+    gchar *data;
+    gsize size;
+
+    g_file_get_contents(fixture->path, &data, &size, &error);
+    g_assert_no_error(error);
+    g_assert_cmpuint(offset, <, size);
+    data[offset] ^= 0xff;
+    g_file_set_contents(fixture->path, data, size, &error);
+    g_assert_no_error(error);
+    g_free(data);
+}
+
+static void
+_test_cache_round_trip(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    _test_cache_assert_missing(fixture, 1);
+
+    _test_cache_store(fixture, 1, "src/ main.c main.h", 0);
+    _test_cache_store(fixture, 2, NULL, GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED);
+    _test_cache_store(fixture, 3, "README.md", GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED);
+
+    _test_cache_assert_found(fixture, 1, "src/ main.c main.h", 0);
+    _test_cache_assert_found(fixture, 2, NULL, GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED);
+    _test_cache_assert_found(fixture, 3, "README.md", GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED);
+    _test_cache_assert_missing(fixture, 4);
+
+    _test_cache_reopen(fixture, CACHE_MAX_SIZE);
+    _test_cache_assert_found(fixture, 1, "src/ main.c main.h", 0);
+    _test_cache_assert_found(fixture, 2, NULL, GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED);
+    _test_cache_assert_found(fixture, 3, "README.md", GIT_EVENTC_POST_RECEIVE_CACHE_SIMILARITY_SKIPPED);
+}
+
+static void
+_test_cache_shared(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    GitEventcPostReceiveCache *other;
+    gchar *files = NULL;
+    guint32 flags;
+    git_oid id;
+
+    /* Another hook storing while we have it opened */
+    other = git_eventc_post_receive_cache_new(fixture->directory, CACHE_KEY, CACHE_MAX_SIZE);
+    _test_cache_id(&id, 1);
+    git_eventc_post_receive_cache_store(other, &id, "a.txt", 0);
+    git_eventc_post_receive_cache_free(other);
+
+    g_assert_true(git_eventc_post_receive_cache_lookup(fixture->cache, &id, &files, &flags));
+    g_assert_cmpstr(files, ==, "a.txt");
+    g_free(files);
+}
+
+static void
+_test_cache_append(GitEventcTestCacheFixture *fixture, const gchar *garbage)
+{
+    GError *error = NULL;
+    gsize size, length = strlen(garbage);
+    gchar *data;
+
+    /* Records are binary, no string functions here */
+    g_file_get_contents(fixture->path, &data, &size, &error);
+    g_assert_no_error(error);
+    data = g_realloc(data, size + length);
+    memcpy(data + size, garbage, length);
+    g_file_set_contents(fixture->path, data, size + length, &error);
+    g_assert_no_error(error);
+    g_free(data);
+}
+
+static void
+_test_cache_garbage_tail(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    gsize valid;
+
+    _test_cache_store(fixture, 1, "a.txt", 0);
+    _test_cache_store(fixture, 2, "b.txt", 0);
+    valid = _test_cache_size(fixture);
+
+    _test_cache_append(fixture, "not a record");
+    _test_cache_reopen(fixture, CACHE_MAX_SIZE);
+    g_assert_cmpuint(_test_cache_size(fixture), ==, valid);
+    _test_cache_assert_found(fixture, 1, "a.txt", 0);
+    _test_cache_assert_found(fixture, 2, "b.txt", 0);
+}
+
+static void
+_test_cache_torn_record(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    _test_cache_store(fixture, 1, "a.txt", 0);
+
+    /* A crashed writer: it may still be written, readers leave it alone */
+    _test_cache_append(fixture, "GEfr torn");
+    _test_cache_reopen(fixture, CACHE_MAX_SIZE);
+    _test_cache_assert_found(fixture, 1, "a.txt", 0);
+
+    /* But writers own the lock, they drop it before appending */
+    _test_cache_store(fixture, 2, "b.txt", 0);
+    _test_cache_reopen(fixture, CACHE_MAX_SIZE);
+    _test_cache_assert_found(fixture, 1, "a.txt", 0);
+    _test_cache_assert_found(fixture, 2, "b.txt", 0);
+}
+
+static void
+_test_cache_broken_record(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    gsize first, second;
+
+    _test_cache_store(fixture, 1, "a.txt", 0);
+    first = _test_cache_size(fixture);
+    _test_cache_store(fixture, 2, "b.txt", 0);
+    second = _test_cache_size(fixture);
+    _test_cache_store(fixture, 3, "c.txt", 0);
+
+    /* The checksum catches a flipped byte in the files */
+    _test_cache_corrupt(fixture, second - 1);
+
+    _test_cache_reopen(fixture, CACHE_MAX_SIZE);
+    g_assert_cmpuint(_test_cache_size(fixture), ==, first);
+    _test_cache_assert_found(fixture, 1, "a.txt", 0);
+    _test_cache_assert_missing(fixture, 2);
+    _test_cache_assert_missing(fixture, 3);
+}
+
+static void
+_test_cache_invalid_magic(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    _test_cache_store(fixture, 1, "a.txt", 0);
+    _test_cache_corrupt(fixture, 0);
+
+    _test_cache_reopen(fixture, CACHE_MAX_SIZE);
+    _test_cache_assert_missing(fixture, 1);
+
+    _test_cache_store(fixture, 2, "b.txt", 0);
+    _test_cache_reopen(fixture, CACHE_MAX_SIZE);
+    _test_cache_assert_found(fixture, 2, "b.txt", 0);
+}
+
+#define COMPACT_MAX_SIZE 1024
+#define COMPACT_RECORDS 100
+
+static void
+_test_cache_compact(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    gchar files[64];
+    guint i;
+
+    for ( i = 0 ; i < COMPACT_RECORDS ; ++i )
+    {
+        g_snprintf(files, sizeof(files), "file-%u.txt", i);
+        _test_cache_store(fixture, i, files, 0);
+        g_assert_cmpuint(_test_cache_size(fixture), <=, COMPACT_MAX_SIZE);
+    }
+
+    _test_cache_reopen(fixture, COMPACT_MAX_SIZE);
+
+    /* The newest are kept, the oldest dropped */
+    g_snprintf(files, sizeof(files), "file-%u.txt", COMPACT_RECORDS - 1);
+    _test_cache_assert_found(fixture, COMPACT_RECORDS - 1, files, 0);
+    _test_cache_assert_missing(fixture, 0);
+}
+
+/* Magic and record header, as laid out in post-receive-cache.c */
+#define COMPACT_LARGEST_LENGTH (COMPACT_MAX_SIZE / 2 - 19 - 36)
+
+static void
+_test_cache_compact_largest(GitEventcTestCacheFixture *fixture, gconstpointer user_data)
+{
+    gchar files[64];
+    gchar *largest;
+    guint i;
+
+    for ( i = 0 ; i < COMPACT_RECORDS ; ++i )
+    {
+        g_snprintf(files, sizeof(files), "file-%u.txt", i);
+        _test_cache_store(fixture, i, files, 0);
+    }
+
+    /* Each one compacts the cache at least once, and must not loop doing so */
+    largest = g_strnfill(COMPACT_LARGEST_LENGTH, 'a');
+    for ( i = 0 ; i < 3 ; ++i )
+    {
+        _test_cache_store(fixture, COMPACT_RECORDS + i, largest, 0);
+        g_assert_cmpuint(_test_cache_size(fixture), <=, COMPACT_MAX_SIZE);
+    }
+
+    _test_cache_reopen(fixture, COMPACT_MAX_SIZE);
+    _test_cache_assert_found(fixture, COMPACT_RECORDS + 2, largest, 0);
+    g_free(largest);
+
+    /* One more byte and it could never fit, it is not cached */
+    largest = g_strnfill(COMPACT_LARGEST_LENGTH + 1, 'a');
+    _test_cache_store(fixture, COMPACT_RECORDS + 3, largest, 0);
+    g_free(largest);
+
+    _test_cache_reopen(fixture, COMPACT_MAX_SIZE);
+    _test_cache_assert_missing(fixture, COMPACT_RECORDS + 3);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /* Repairing a broken cache warns, it is what we test */
+    g_log_set_always_fatal(G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL);
+
+    g_test_add("/cache/round-trip", GitEventcTestCacheFixture, GSIZE_TO_POINTER(CACHE_MAX_SIZE), _test_cache_setup, _test_cache_round_trip, _test_cache_teardown);
+    g_test_add("/cache/shared", GitEventcTestCacheFixture, GSIZE_TO_POINTER(CACHE_MAX_SIZE), _test_cache_setup, _test_cache_shared, _test_cache_teardown);
+    g_test_add("/cache/garbage-tail", GitEventcTestCacheFixture, GSIZE_TO_POINTER(CACHE_MAX_SIZE), _test_cache_setup, _test_cache_garbage_tail, _test_cache_teardown);
+    g_test_add("/cache/torn-record", GitEventcTestCacheFixture, GSIZE_TO_POINTER(CACHE_MAX_SIZE), _test_cache_setup, _test_cache_torn_record, _test_cache_teardown);
+    g_test_add("/cache/broken-record", GitEventcTestCacheFixture, GSIZE_TO_POINTER(CACHE_MAX_SIZE), _test_cache_setup, _test_cache_broken_record, _test_cache_teardown);
+    g_test_add("/cache/invalid-magic", GitEventcTestCacheFixture, GSIZE_TO_POINTER(CACHE_MAX_SIZE), _test_cache_setup, _test_cache_invalid_magic, _test_cache_teardown);
+    g_test_add("/cache/compact", GitEventcTestCacheFixture, GSIZE_TO_POINTER(COMPACT_MAX_SIZE), _test_cache_setup, _test_cache_compact, _test_cache_teardown);
+    g_test_add("/cache/compact-largest", GitEventcTestCacheFixture, GSIZE_TO_POINTER(COMPACT_MAX_SIZE), _test_cache_setup, _test_cache_compact_largest, _test_cache_teardown);
+
+    return g_test_run();
+}
@@ -0,0 +1,373 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <git2.h>
+
+#include "sink.h"
+
+/*
+ * Generates repositories of known shapes and runs the hook on them,
+ * against a sink that swallows everything (see sink.c).
+ * Set GIT_EVENTC_BENCH_SCALE to divide the sizes, e.g. 100 for a quick run.
+ */
+
+#define BENCH_TIME 1500000000
+
+typedef struct {
+    git_repository *repository;
+    guint scale;
+    guint64 counter;
+    GString *input;
+    guint refs;
+} GitEventcBench;
+
+#define check(e) G_STMT_START { \
+        if ( (e) < 0 ) \
+        { \
+            g_printerr("%s:%d: %s: %s\n", __FILE__, __LINE__, #e, giterr_last()->message); \
+            exit(2); \
+        } \
+    } G_STMT_END
+
+static guint
+_git_eventc_bench_size(GitEventcBench *bench, guint size)
+{
+    return MAX(size / bench->scale, 1);
+}
+
+static void
+_git_eventc_bench_blob(GitEventcBench *bench, git_oid *id, const gchar *fmt, guint64 n)
+{
+    gchar *data;
+
+    data = g_strdup_printf(fmt, n);
+    check(git_blob_create_frombuffer(id, bench->repository, data, strlen(data)));
+    g_free(data);
+}
+
+static void
+_git_eventc_bench_commit(GitEventcBench *bench, git_oid *id, const git_oid *tree_id, const git_oid *parents_id, gsize parent_count)
+{
+    git_signature *signature;
+    git_tree *tree;
+    const git_commit *parents[parent_count + 1];
+    gsize i;
+    gchar *message;
+
+    ++bench->counter;
+    check(git_signature_new(&signature, "Jane Doe", "jane@example.com", BENCH_TIME + bench->counter, 0));
+    check(git_tree_lookup(&tree, bench->repository, tree_id));
+    for ( i = 0 ; i < parent_count ; ++i )
+        check(git_commit_lookup((git_commit **) &parents[i], bench->repository, &parents_id[i]));
+
+    message = g_strdup_printf("Commit %" G_GUINT64_FORMAT "\n\nSome body.\n", bench->counter);
+    check(git_commit_create(id, bench->repository, NULL, signature, signature, NULL, message, tree, parent_count, parents));
+
+    g_free(message);
+    for ( i = 0 ; i < parent_count ; ++i )
+        git_commit_free((git_commit *) parents[i]);
+    git_tree_free(tree);
+    git_signature_free(signature);
+}
+
+/* A tree of files, grouped in directories of width entries */
+static void
+_git_eventc_bench_tree(GitEventcBench *bench, git_oid *id, guint files, guint width, const gchar *prefix, gboolean distinct)
+{
+    git_treebuilder *root, *dir = NULL;
+    git_oid blob_id, dir_id;
+    guint i;
+    gchar name[64];
+
+    check(git_treebuilder_new(&root, bench->repository, NULL));
+    if ( ! distinct )
+        _git_eventc_bench_blob(bench, &blob_id, "Same content %" G_GUINT64_FORMAT "\n", 0);
+
+    for ( i = 0 ; i < files ; ++i )
+    {
+        if ( dir == NULL )
+            check(git_treebuilder_new(&dir, bench->repository, NULL));
+
+        if ( distinct )
+            /* Big enough for similarity detection */
+            _git_eventc_bench_blob(bench, &blob_id, "File %" G_GUINT64_FORMAT "\n"
+                "Lorem ipsum dolor sit amet, consectetur adipiscing elit.\n"
+                "Sed do eiusmod tempor incididunt ut labore et dolore magna aliqua.\n"
+                "Ut enim ad minim veniam, quis nostrud exercitation ullamco.\n", i);
+        g_snprintf(name, sizeof(name), "file-%u.txt", i);
+        check(git_treebuilder_insert(NULL, dir, name, &blob_id, GIT_FILEMODE_BLOB));
+
+        if ( ( ( i + 1 ) % width == 0 ) || ( i + 1 == files ) )
+        {
+            check(git_treebuilder_write(&dir_id, dir));
+            git_treebuilder_free(dir);
+            dir = NULL;
+            g_snprintf(name, sizeof(name), "%s-%u", prefix, i / width);
+            check(git_treebuilder_insert(NULL, root, name, &dir_id, GIT_FILEMODE_TREE));
+        }
+    }
+
+    check(git_treebuilder_write(id, root));
+    git_treebuilder_free(root);
+}
+
+static void
+_git_eventc_bench_chain(GitEventcBench *bench, git_oid *tip, const git_oid *tree_id, const git_oid *from, guint length)
+{
+    git_oid parent;
+    guint i;
+
+    if ( from != NULL )
+        git_oid_cpy(&parent, from);
+    for ( i = 0 ; i < length ; ++i )
+    {
+        _git_eventc_bench_commit(bench, tip, tree_id, ( i > 0 || from != NULL ) ? &parent : NULL, ( i > 0 || from != NULL ) ? 1 : 0);
+        git_oid_cpy(&parent, tip);
+    }
+}
+
+static void
+_git_eventc_bench_ref(GitEventcBench *bench, const gchar *name, const git_oid *from, const git_oid *to)
+{
+    gchar before[GIT_OID_HEXSZ + 1], after[GIT_OID_HEXSZ + 1];
+    git_reference *ref;
+
+    check(git_reference_create(&ref, bench->repository, name, to, TRUE, NULL));
+    git_reference_free(ref);
+
+    git_oid_tostr(before, sizeof(before), from);
+    git_oid_tostr(after, sizeof(after), to);
+    g_string_append_printf(bench->input, "%s %s %s\n", before, after, name);
+    ++bench->refs;
+}
+
+static void
+_git_eventc_bench_linear(GitEventcBench *bench)
+{
+    git_oid tree, root, tip;
+
+    _git_eventc_bench_tree(bench, &tree, 10, 10, "dir", FALSE);
+    _git_eventc_bench_chain(bench, &root, &tree, NULL, 1);
+    _git_eventc_bench_chain(bench, &tip, &tree, &root, _git_eventc_bench_size(bench, 100000));
+    _git_eventc_bench_ref(bench, "refs/heads/master", &root, &tip);
+}
+
+static void
+_git_eventc_bench_tags(GitEventcBench *bench)
+{
+    git_oid tree, id, zero = { .id = { 0 } };
+    guint i, l = _git_eventc_bench_size(bench, 50000);
+    gchar name[64];
+
+    _git_eventc_bench_tree(bench, &tree, 10, 10, "dir", FALSE);
+    _git_eventc_bench_chain(bench, &id, &tree, NULL, 1);
+    for ( i = 0 ; i < l ; ++i )
+    {
+        _git_eventc_bench_chain(bench, &id, &tree, &id, 2);
+        g_snprintf(name, sizeof(name), "refs/tags/v%u", i);
+        _git_eventc_bench_ref(bench, name, &zero, &id);
+    }
+}
+
+static void
+_git_eventc_bench_root_tree(GitEventcBench *bench)
+{
+    git_oid tree, id, zero = { .id = { 0 } };
+
+    _git_eventc_bench_tree(bench, &tree, _git_eventc_bench_size(bench, 1000000), 1000, "dir", FALSE);
+    _git_eventc_bench_chain(bench, &id, &tree, NULL, 1);
+    _git_eventc_bench_ref(bench, "refs/heads/import", &zero, &id);
+}
+
+static void
+_git_eventc_bench_renames(GitEventcBench *bench)
+{
+    git_oid before, after, root, id;
+    guint files = _git_eventc_bench_size(bench, 10000);
+
+    _git_eventc_bench_tree(bench, &before, files, 100, "old", TRUE);
+    _git_eventc_bench_tree(bench, &after, files, 100, "new", TRUE);
+    _git_eventc_bench_chain(bench, &root, &before, NULL, 1);
+    _git_eventc_bench_chain(bench, &id, &after, &root, 1);
+    _git_eventc_bench_ref(bench, "refs/heads/refactor", &root, &id);
+}
+
+static void
+_git_eventc_bench_octopus(GitEventcBench *bench)
+{
+    git_oid tree, root, tips[8], id;
+    guint i, l = _git_eventc_bench_size(bench, 1000);
+
+    _git_eventc_bench_tree(bench, &tree, 10, 10, "dir", FALSE);
+    _git_eventc_bench_chain(bench, &root, &tree, NULL, 1);
+    for ( i = 0 ; i < G_N_ELEMENTS(tips) ; ++i )
+        _git_eventc_bench_chain(bench, &tips[i], &tree, &root, l);
+    _git_eventc_bench_commit(bench, &id, &tree, tips, G_N_ELEMENTS(tips));
+    _git_eventc_bench_ref(bench, "refs/heads/integration", &root, &id);
+}
+
+static const struct {
+    const gchar *name;
+    void (*generate)(GitEventcBench *bench);
+} _git_eventc_bench_list[] = {
+    { "linear",    _git_eventc_bench_linear },
+    { "tags",      _git_eventc_bench_tags },
+    { "root-tree", _git_eventc_bench_root_tree },
+    { "renames",   _git_eventc_bench_renames },
+    { "octopus",   _git_eventc_bench_octopus },
+};
+
+static gboolean
+_git_eventc_bench_run(const gchar *hook, const gchar *path, const gchar *host, GString *input, gint64 *time, glong *rss)
+{
+    GError *error = NULL;
+    gchar *args[] = { (gchar *) hook, "--host", (gchar *) host, "--find-renames", "--profile", NULL };
+    GPid pid;
+    gint stdin_fd, status;
+    struct rusage usage;
+    gint64 start;
+
+    start = g_get_monotonic_time();
+    if ( ! g_spawn_async_with_pipes(path, args, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &stdin_fd, NULL, NULL, &error) )
+    {
+        g_printerr("Couldn't run %s: %s\n", hook, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    gsize o = 0;
+    while ( o < input->len )
+    {
+        gssize r = write(stdin_fd, input->str + o, input->len - o);
+        if ( ( r < 0 ) && ( errno != EINTR ) )
+            break;
+        if ( r > 0 )
+            o += r;
+    }
+    g_close(stdin_fd, NULL);
+
+    while ( wait4(pid, &status, 0, &usage) < 0 )
+    {
+        if ( errno != EINTR )
+            return FALSE;
+    }
+    *time = g_get_monotonic_time() - start;
+    *rss = usage.ru_maxrss;
+    g_spawn_close_pid(pid);
+
+    return WIFEXITED(status) && ( WEXITSTATUS(status) == 0 );
+}
+
+int
+main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    const gchar *scale_env = g_getenv("GIT_EVENTC_BENCH_SCALE");
+    gchar *tmp = NULL;
+    int retval = 1;
+
+    if ( argc < 2 )
+    {
+        g_printerr("Usage: %s <hook>\n", argv[0]);
+        return 1;
+    }
+
+    git_libgit2_init();
+
+    GitEventcTestSink *sink;
+    const gchar *host;
+
+    /* A bare reader would leave the client waiting for the WebSocket handshake */
+    sink = git_eventc_test_sink_new(&error);
+    if ( sink == NULL )
+    {
+        g_printerr("Couldn't start the sink: %s\n", error->message);
+        g_error_free(error);
+        goto end;
+    }
+    host = git_eventc_test_sink_get_host(sink);
+
+    tmp = g_dir_make_tmp("git-eventc-bench-XXXXXX", &error);
+    if ( tmp == NULL )
+    {
+        g_printerr("Couldn't create a temporary directory: %s\n", error->message);
+        g_error_free(error);
+        goto stop;
+    }
+
+    GitEventcBench bench = {
+        .scale = ( scale_env != NULL ) ? MAX(g_ascii_strtoull(scale_env, NULL, 10), 1) : 1,
+    };
+    gsize i;
+    retval = 0;
+    for ( i = 0 ; i < G_N_ELEMENTS(_git_eventc_bench_list) ; ++i )
+    {
+        gchar *path = g_build_filename(tmp, _git_eventc_bench_list[i].name, NULL);
+        gint64 generation, time;
+        glong rss;
+
+        generation = g_get_monotonic_time();
+        check(git_repository_init(&bench.repository, path, TRUE));
+        bench.input = g_string_new("");
+        bench.refs = 0;
+        _git_eventc_bench_list[i].generate(&bench);
+        git_repository_free(bench.repository);
+        generation = g_get_monotonic_time() - generation;
+
+        if ( _git_eventc_bench_run(argv[1], path, host, bench.input, &time, &rss) )
+            g_print("%-10s %6u refs: %8" G_GINT64_FORMAT " ms, %8" G_GINT64_FORMAT " µs/ref, %7ld KiB max RSS (generated in %" G_GINT64_FORMAT " ms)\n", _git_eventc_bench_list[i].name, bench.refs, time / 1000, time / bench.refs, rss, generation / 1000);
+        else
+        {
+            g_print("%-10s failed\n", _git_eventc_bench_list[i].name);
+            retval = 1;
+        }
+
+        g_string_free(bench.input, TRUE);
+        g_free(path);
+    }
+
+    gchar *rm[] = { "rm", "-rf", tmp, NULL };
+    g_spawn_sync(NULL, rm, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, NULL, NULL);
+
+stop:
+    git_eventc_test_sink_free(sink);
+end:
+    g_free(tmp);
+    git_libgit2_shutdown();
+
+    return retval;
+}
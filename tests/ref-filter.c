@@ -0,0 +1,235 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "post-receive-ref-filter.h"
+
+/* The maximum number of patterns tested */
+#define MAX_PATTERNS 3
+
+static const struct {
+    const gchar *testpath;
+    const gchar * const include[MAX_PATTERNS + 1];
+    const gchar * const exclude[MAX_PATTERNS + 1];
+    const gchar *name;
+    gboolean match;
+} _test_list[] = {
+    {
+        .testpath = "/ref-filter/empty",
+        .include = { NULL },
+        .exclude = { NULL },
+        .name = "refs/heads/master",
+        .match = TRUE,
+    },
+    {
+        .testpath = "/ref-filter/exact/match",
+        .include = { "refs/heads/master", NULL },
+        .exclude = { NULL },
+        .name = "refs/heads/master",
+        .match = TRUE,
+    },
+    {
+        .testpath = "/ref-filter/exact/longer",
+        .include = { "refs/heads/master", NULL },
+        .exclude = { NULL },
+        .name = "refs/heads/master-old",
+        .match = FALSE,
+    },
+    {
+        .testpath = "/ref-filter/exact/shorter",
+        .include = { "refs/heads/master", NULL },
+        .exclude = { NULL },
+        .name = "refs/heads/mast",
+        .match = FALSE,
+    },
+    {
+        .testpath = "/ref-filter/prefix/match",
+        .include = { "refs/heads/*", NULL },
+        .exclude = { NULL },
+        .name = "refs/heads/feature/foo",
+        .match = TRUE,
+    },
+    {
+        .testpath = "/ref-filter/prefix/no-match",
+        .include = { "refs/heads/*", NULL },
+        .exclude = { NULL },
+        .name = "refs/tags/v1",
+        .match = FALSE,
+    },
+    {
+        .testpath = "/ref-filter/glob/match",
+        .include = { "refs/heads/release-*.x", NULL },
+        .exclude = { NULL },
+        .name = "refs/heads/release-1.x",
+        .match = TRUE,
+    },
+    {
+        .testpath = "/ref-filter/glob/no-match",
+        .include = { "refs/heads/release-?", NULL },
+        .exclude = { NULL },
+        .name = "refs/heads/release-10",
+        .match = FALSE,
+    },
+    {
+        .testpath = "/ref-filter/several-includes",
+        .include = { "refs/heads/master", "refs/tags/*", NULL },
+        .exclude = { NULL },
+        .name = "refs/tags/v1",
+        .match = TRUE,
+    },
+    {
+        .testpath = "/ref-filter/exclude-only",
+        .include = { NULL },
+        .exclude = { "refs/heads/wip/*", NULL },
+        .name = "refs/heads/wip/foo",
+        .match = FALSE,
+    },
+    {
+        .testpath = "/ref-filter/exclude-wins",
+        .include = { "refs/heads/*", NULL },
+        .exclude = { "refs/heads/wip/*", NULL },
+        .name = "refs/heads/wip/foo",
+        .match = FALSE,
+    },
+    {
+        .testpath = "/ref-filter/exclude-other",
+        .include = { "refs/heads/*", NULL },
+        .exclude = { "refs/heads/wip/*", NULL },
+        .name = "refs/heads/master",
+        .match = TRUE,
+    },
+};
+
+static GitEventcPostReceiveRefFilter *
+_test_filter_new(const gchar * const *include, const gchar * const *exclude)
+{
+    GitEventcPostReceiveRefFilter *filter;
+    const gchar * const *pattern;
+
+    filter = git_eventc_post_receive_ref_filter_new();
+    for ( pattern = include ; *pattern != NULL ; ++pattern )
+        git_eventc_post_receive_ref_filter_add(filter, *pattern, FALSE);
+    for ( pattern = exclude ; *pattern != NULL ; ++pattern )
+        git_eventc_post_receive_ref_filter_add(filter, *pattern, TRUE);
+
+    return filter;
+}
+
+static void
+_test_match(gconstpointer user_data)
+{
+    gsize i = GPOINTER_TO_SIZE(user_data);
+    GitEventcPostReceiveRefFilter *filter;
+
+    filter = _test_filter_new(_test_list[i].include, _test_list[i].exclude);
+    g_assert_cmpint(git_eventc_post_receive_ref_filter_match(filter, _test_list[i].name), ==, _test_list[i].match);
+    git_eventc_post_receive_ref_filter_free(filter);
+}
+
+static void
+_test_empty_pattern(void)
+{
+    GitEventcPostReceiveRefFilter *filter;
+
+    filter = git_eventc_post_receive_ref_filter_new();
+    git_eventc_post_receive_ref_filter_add(filter, "", FALSE);
+    g_assert_true(git_eventc_post_receive_ref_filter_is_empty(filter));
+    git_eventc_post_receive_ref_filter_add(filter, "refs/heads/*", TRUE);
+    g_assert_false(git_eventc_post_receive_ref_filter_is_empty(filter));
+    git_eventc_post_receive_ref_filter_free(filter);
+}
+
+#define OLD "0000000000000000000000000000000000000000"
+#define NEW "1111111111111111111111111111111111111111"
+
+static const struct {
+    const gchar *testpath;
+    const gchar *input;
+    const gchar *output;
+} _test_input_list[] = {
+    {
+        .testpath = "/filter-input/keep-all",
+        .input = OLD " " NEW " refs/heads/master\n" OLD " " NEW " refs/heads/next\n",
+        .output = OLD " " NEW " refs/heads/master\n" OLD " " NEW " refs/heads/next\n",
+    },
+    {
+        .testpath = "/filter-input/drop-excluded",
+        .input = OLD " " NEW " refs/heads/wip/foo\n" OLD " " NEW " refs/heads/master\n" OLD " " NEW " refs/heads/wip/bar\n",
+        .output = OLD " " NEW " refs/heads/master\n",
+    },
+    {
+        .testpath = "/filter-input/drop-all",
+        .input = OLD " " NEW " refs/heads/wip/foo\n",
+        .output = "",
+    },
+    {
+        .testpath = "/filter-input/keep-malformed",
+        .input = "garbage\n" OLD " " NEW " refs/heads/wip/foo\n",
+        .output = "garbage\n",
+    },
+    {
+        .testpath = "/filter-input/drop-incomplete",
+        .input = OLD " " NEW " refs/heads/master\n" OLD " " NEW " refs/heads/next",
+        .output = OLD " " NEW " refs/heads/master\n",
+    },
+};
+
+static void
+_test_input(gconstpointer user_data)
+{
+    gsize i = GPOINTER_TO_SIZE(user_data);
+    GitEventcPostReceiveRefFilter *filter;
+    gchar *input;
+    gsize length;
+
+    filter = git_eventc_post_receive_ref_filter_new();
+    git_eventc_post_receive_ref_filter_add(filter, "refs/heads/wip/*", TRUE);
+
+    input = g_strdup(_test_input_list[i].input);
+    length = git_eventc_post_receive_ref_filter_input(filter, input, strlen(input));
+    g_assert_cmpuint(length, ==, strlen(_test_input_list[i].output));
+    g_assert_cmpmem(input, length, _test_input_list[i].output, length);
+
+    g_free(input);
+    git_eventc_post_receive_ref_filter_free(filter);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    gsize i;
+    for ( i = 0 ; i < G_N_ELEMENTS(_test_list) ; ++i )
+        g_test_add_data_func(_test_list[i].testpath, GSIZE_TO_POINTER(i), _test_match);
+    g_test_add_func("/ref-filter/empty-pattern", _test_empty_pattern);
+    for ( i = 0 ; i < G_N_ELEMENTS(_test_input_list) ; ++i )
+        g_test_add_data_func(_test_input_list[i].testpath, GSIZE_TO_POINTER(i), _test_input);
+
+    return g_test_run();
+}
@@ -0,0 +1,151 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <git2.h>
+#include <git2/sys/hashsig.h>
+
+#include "post-receive-similarity.h"
+
+/* Too small for libgit2 signatures unless explicitly allowed */
+static const struct {
+    const gchar *testpath;
+    guint32 find_flags;
+    const gchar *from;
+    const gchar *to;
+    gboolean renamed;
+} _test_list[] = {
+    {
+        .testpath = "/similarity/smart-whitespace",
+        .find_flags = GIT_DIFF_FIND_RENAMES,
+        .from = "hello\r\nworld\r\n",
+        .to = "hello\nworld\n",
+        .renamed = TRUE,
+    },
+    {
+        .testpath = "/similarity/dont-ignore-whitespace",
+        .find_flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_DONT_IGNORE_WHITESPACE,
+        .from = "hello\r\nworld\r\n",
+        .to = "hello\nworld\n",
+        .renamed = FALSE,
+    },
+    {
+        .testpath = "/similarity/smart-inner-whitespace",
+        .find_flags = GIT_DIFF_FIND_RENAMES,
+        .from = "hello world\n",
+        .to = "helloworld\n",
+        .renamed = FALSE,
+    },
+    {
+        .testpath = "/similarity/ignore-whitespace",
+        .find_flags = GIT_DIFF_FIND_RENAMES | GIT_DIFF_FIND_IGNORE_WHITESPACE,
+        .from = "hello world\n",
+        .to = "helloworld\n",
+        .renamed = TRUE,
+    },
+};
+
+static void
+_test_tree(git_repository *repository, const gchar *name, const gchar *content, git_tree **tree)
+{
+    git_treebuilder *builder;
+    git_oid id;
+
+    g_assert_cmpint(git_treebuilder_new(&builder, repository, NULL), ==, 0);
+    g_assert_cmpint(git_blob_create_frombuffer(&id, repository, content, strlen(content)), ==, 0);
+    g_assert_cmpint(git_treebuilder_insert(NULL, builder, name, &id, GIT_FILEMODE_BLOB), ==, 0);
+    g_assert_cmpint(git_treebuilder_write(&id, builder), ==, 0);
+    git_treebuilder_free(builder);
+    g_assert_cmpint(git_tree_lookup(tree, repository, &id), ==, 0);
+}
+
+static void
+_test_rename(gconstpointer user_data)
+{
+    gsize i = GPOINTER_TO_SIZE(user_data);
+    GError *error = NULL;
+    git_repository *repository;
+    gchar *tmp, *path;
+    git_tree *from, *to;
+    git_diff *diff;
+    git_diff_find_options options;
+    GitEventcPostReceiveSimilarity similarity;
+    const git_diff_delta *delta;
+
+    tmp = g_dir_make_tmp("git-eventc-similarity-XXXXXX", &error);
+    g_assert_no_error(error);
+    path = g_build_filename(tmp, "repository.git", NULL);
+    g_assert_cmpint(git_repository_init(&repository, path, TRUE), ==, 0);
+
+    _test_tree(repository, "a.txt", _test_list[i].from, &from);
+    _test_tree(repository, "b.txt", _test_list[i].to, &to);
+    g_assert_cmpint(git_diff_tree_to_tree(&diff, repository, from, to, NULL), ==, 0);
+
+    g_assert_cmpint(git_diff_find_init_options(&options, GIT_DIFF_FIND_OPTIONS_VERSION), ==, 0);
+    options.flags = _test_list[i].find_flags;
+    git_eventc_post_receive_similarity_init(&similarity, options.flags, 0);
+    options.metric = &similarity.metric;
+    g_assert_cmpint(git_diff_find_similar(diff, &options), ==, 0);
+    g_assert_false(similarity.expired);
+
+    if ( _test_list[i].renamed )
+    {
+        g_assert_cmpuint(git_diff_num_deltas(diff), ==, 1);
+        delta = git_diff_get_delta(diff, 0);
+        g_assert_cmpint(delta->status, ==, GIT_DELTA_RENAMED);
+        g_assert_cmpstr(delta->old_file.path, ==, "a.txt");
+        g_assert_cmpstr(delta->new_file.path, ==, "b.txt");
+    }
+    else
+        g_assert_cmpuint(git_diff_num_deltas(diff), ==, 2);
+
+    git_diff_free(diff);
+    git_tree_free(to);
+    git_tree_free(from);
+    git_repository_free(repository);
+
+    gchar *rm[] = { "rm", "-rf", tmp, NULL };
+    g_spawn_sync(NULL, rm, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, NULL, NULL);
+    g_free(path);
+    g_free(tmp);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    git_libgit2_init();
+
+    gsize i;
+    for ( i = 0 ; i < G_N_ELEMENTS(_test_list) ; ++i )
+        g_test_add_data_func(_test_list[i].testpath, GSIZE_TO_POINTER(i), _test_rename);
+
+    gint ret = g_test_run();
+    git_libgit2_shutdown();
+    return ret;
+}
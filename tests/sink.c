@@ -0,0 +1,306 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "sink.h"
+
+/*
+ * An eventd stand-in swallowing everything: the EvP client speaks
+ * WebSocket, so we do the server side of the handshake, answer pings
+ * and the closing handshake, and count the data messages.
+ */
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WEBSOCKET_MAX_PAYLOAD (16 << 20)
+
+enum {
+    WEBSOCKET_OPCODE_CONTINUATION = 0x0,
+    WEBSOCKET_OPCODE_TEXT = 0x1,
+    WEBSOCKET_OPCODE_BINARY = 0x2,
+    WEBSOCKET_OPCODE_CLOSE = 0x8,
+    WEBSOCKET_OPCODE_PING = 0x9,
+    WEBSOCKET_OPCODE_PONG = 0xa,
+};
+
+struct _GitEventcTestSink {
+    GSocketService *service;
+    GMainLoop *loop;
+    GThread *thread;
+    gchar *host;
+    GMutex mutex;
+    GCond cond;
+    gint64 first_event;
+};
+
+static gboolean
+_git_eventc_test_sink_handshake(GDataInputStream *in, GOutputStream *out)
+{
+    gchar *line, *key = NULL, *protocol = NULL;
+    gboolean complete = FALSE, ret = FALSE;
+
+    while ( ( line = g_data_input_stream_read_line(in, NULL, NULL, NULL) ) != NULL )
+    {
+        g_strchomp(line);
+        if ( *line == '\0' )
+        {
+            complete = TRUE;
+            g_free(line);
+            break;
+        }
+
+        gchar *value = strchr(line, ':');
+        if ( value != NULL )
+        {
+            *value++ = '\0';
+            value = g_strstrip(value);
+            if ( g_ascii_strcasecmp(line, "Sec-WebSocket-Key") == 0 )
+                key = g_strdup(value);
+            else if ( g_ascii_strcasecmp(line, "Sec-WebSocket-Protocol") == 0 )
+                /* We take the first one offered */
+                protocol = g_strstrip(g_strndup(value, strcspn(value, ",")));
+        }
+        g_free(line);
+    }
+    if ( ( ! complete ) || ( key == NULL ) )
+        goto out;
+
+    GChecksum *checksum;
+    guint8 digest[20];
+    gsize digest_length = sizeof(digest);
+    gchar *accept;
+    GString *answer;
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, (const guchar *) key, -1);
+    g_checksum_update(checksum, (const guchar *) WEBSOCKET_GUID, -1);
+    g_checksum_get_digest(checksum, digest, &digest_length);
+    g_checksum_free(checksum);
+    accept = g_base64_encode(digest, digest_length);
+
+    answer = g_string_new("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n");
+    g_string_append_printf(answer, "Sec-WebSocket-Accept: %s\r\n", accept);
+    if ( protocol != NULL )
+        g_string_append_printf(answer, "Sec-WebSocket-Protocol: %s\r\n", protocol);
+    g_string_append(answer, "\r\n");
+
+    ret = g_output_stream_write_all(out, answer->str, answer->len, NULL, NULL, NULL);
+
+    g_string_free(answer, TRUE);
+    g_free(accept);
+out:
+    g_free(protocol);
+    g_free(key);
+    return ret;
+}
+
+static gboolean
+_git_eventc_test_sink_send_frame(GOutputStream *out, guint8 opcode, const guint8 *payload, gsize length)
+{
+    /* Only used for control frames, always short and never masked */
+    guint8 header[2] = { 0x80 | opcode, MIN(length, 125) };
+
+    return g_output_stream_write_all(out, header, sizeof(header), NULL, NULL, NULL) && g_output_stream_write_all(out, payload, header[1], NULL, NULL, NULL);
+}
+
+static void
+_git_eventc_test_sink_event(GitEventcTestSink *self)
+{
+    g_mutex_lock(&self->mutex);
+    if ( self->first_event == 0 )
+    {
+        self->first_event = g_get_monotonic_time();
+        g_cond_broadcast(&self->cond);
+    }
+    g_mutex_unlock(&self->mutex);
+}
+
+static gboolean
+_git_eventc_test_sink_run(GThreadedSocketService *service, GSocketConnection *connection, GObject *source_object, gpointer user_data)
+{
+    GitEventcTestSink *self = user_data;
+    GDataInputStream *in;
+    GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    guint8 *payload = NULL;
+
+    in = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_filter_input_stream_set_close_base_stream(G_FILTER_INPUT_STREAM(in), FALSE);
+    g_data_input_stream_set_newline_type(in, G_DATA_STREAM_NEWLINE_TYPE_ANY);
+
+    if ( ! _git_eventc_test_sink_handshake(in, G_OUTPUT_STREAM(out)) )
+        goto out;
+
+    for (;;)
+    {
+        guint8 header[2], mask[4];
+        guint64 length;
+        gsize i;
+
+        if ( ! g_input_stream_read_all(G_INPUT_STREAM(in), header, sizeof(header), &i, NULL, NULL) || ( i < sizeof(header) ) )
+            break;
+
+        length = header[1] & 0x7f;
+        if ( length >= 126 )
+        {
+            guint8 extended[8];
+            gsize size = ( length == 126 ) ? 2 : 8;
+            if ( ! g_input_stream_read_all(G_INPUT_STREAM(in), extended, size, &i, NULL, NULL) || ( i < size ) )
+                break;
+            for ( length = 0, i = 0 ; i < size ; ++i )
+                length = ( length << 8 ) | extended[i];
+        }
+        if ( length > WEBSOCKET_MAX_PAYLOAD )
+            break;
+
+        if ( ( header[1] & 0x80 ) && ( ! g_input_stream_read_all(G_INPUT_STREAM(in), mask, sizeof(mask), &i, NULL, NULL) || ( i < sizeof(mask) ) ) )
+            break;
+
+        payload = g_realloc(payload, MAX(length, 1));
+        if ( ! g_input_stream_read_all(G_INPUT_STREAM(in), payload, length, &i, NULL, NULL) || ( i < length ) )
+            break;
+        if ( header[1] & 0x80 )
+        {
+            for ( i = 0 ; i < length ; ++i )
+                payload[i] ^= mask[i % 4];
+        }
+
+        switch ( header[0] & 0x0f )
+        {
+        case WEBSOCKET_OPCODE_CONTINUATION:
+        case WEBSOCKET_OPCODE_TEXT:
+        case WEBSOCKET_OPCODE_BINARY:
+            if ( header[0] & 0x80 )
+                _git_eventc_test_sink_event(self);
+        break;
+        case WEBSOCKET_OPCODE_PING:
+            if ( ! _git_eventc_test_sink_send_frame(out, WEBSOCKET_OPCODE_PONG, payload, length) )
+                goto out;
+        break;
+        case WEBSOCKET_OPCODE_CLOSE:
+            /* Echo it back, the client waits for it before closing */
+            _git_eventc_test_sink_send_frame(out, WEBSOCKET_OPCODE_CLOSE, payload, length);
+            goto out;
+        case WEBSOCKET_OPCODE_PONG:
+        default:
+        break;
+        }
+    }
+
+out:
+    g_free(payload);
+    g_object_unref(in);
+
+    return TRUE;
+}
+
+static gpointer
+_git_eventc_test_sink_thread(gpointer user_data)
+{
+    g_main_loop_run(user_data);
+    return NULL;
+}
+
+GitEventcTestSink *
+git_eventc_test_sink_new(GError **error)
+{
+    GitEventcTestSink *self;
+    guint16 port;
+
+    self = g_slice_new0(GitEventcTestSink);
+    g_mutex_init(&self->mutex);
+    g_cond_init(&self->cond);
+
+    /* Connections are accepted in the default context, run by our thread */
+    self->service = g_threaded_socket_service_new(-1);
+
+    port = g_socket_listener_add_any_inet_port(G_SOCKET_LISTENER(self->service), NULL, error);
+    if ( port == 0 )
+    {
+        git_eventc_test_sink_free(self);
+        return NULL;
+    }
+    g_signal_connect(self->service, "run", G_CALLBACK(_git_eventc_test_sink_run), self);
+
+    self->host = g_strdup_printf("localhost:%u", port);
+    self->loop = g_main_loop_new(NULL, FALSE);
+    self->thread = g_thread_new("sink", _git_eventc_test_sink_thread, self->loop);
+
+    return self;
+}
+
+void
+git_eventc_test_sink_free(GitEventcTestSink *self)
+{
+    if ( self->thread != NULL )
+    {
+        g_main_loop_quit(self->loop);
+        g_thread_join(self->thread);
+        g_main_loop_unref(self->loop);
+    }
+    g_socket_service_stop(self->service);
+    g_socket_listener_close(G_SOCKET_LISTENER(self->service));
+    g_object_unref(self->service);
+
+    g_free(self->host);
+    g_cond_clear(&self->cond);
+    g_mutex_clear(&self->mutex);
+
+    g_slice_free(GitEventcTestSink, self);
+}
+
+const gchar *
+git_eventc_test_sink_get_host(GitEventcTestSink *self)
+{
+    return self->host;
+}
+
+void
+git_eventc_test_sink_reset(GitEventcTestSink *self)
+{
+    g_mutex_lock(&self->mutex);
+    self->first_event = 0;
+    g_mutex_unlock(&self->mutex);
+}
+
+/*
+ * Returns the monotonic time at which the first event since the last
+ * reset arrived, or 0 if none did within timeout (in microseconds)
+ */
+gint64
+git_eventc_test_sink_wait_first_event(GitEventcTestSink *self, gint64 timeout)
+{
+    gint64 end_time = g_get_monotonic_time() + timeout;
+    gint64 first_event;
+
+    g_mutex_lock(&self->mutex);
+    while ( ( self->first_event == 0 ) && g_cond_wait_until(&self->cond, &self->mutex, end_time) );
+    first_event = self->first_event;
+    g_mutex_unlock(&self->mutex);
+
+    return first_event;
+}
@@ -0,0 +1,36 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GIT_EVENTC_TEST_SINK_H__
+#define __GIT_EVENTC_TEST_SINK_H__
+
+typedef struct _GitEventcTestSink GitEventcTestSink;
+
+GitEventcTestSink *git_eventc_test_sink_new(GError **error);
+void git_eventc_test_sink_free(GitEventcTestSink *self);
+
+const gchar *git_eventc_test_sink_get_host(GitEventcTestSink *self);
+
+void git_eventc_test_sink_reset(GitEventcTestSink *self);
+gint64 git_eventc_test_sink_wait_first_event(GitEventcTestSink *self, gint64 timeout);
+
+#endif /* __GIT_EVENTC_TEST_SINK_H__ */
@@ -0,0 +1,216 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <git2.h>
+
+#include "sink.h"
+
+/* The number of runs we average */
+#define RUNS 50
+
+#define EVENT_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+
+/*
+ * Start-up time of the hook: exec, libraries loading, configuration
+ * and options parsing, connection, up to the first event of a one
+ * commit push reaching our sink
+ */
+
+static gchar *
+_git_eventc_startup_repository(const gchar *path)
+{
+    git_repository *repository = NULL;
+    git_treebuilder *builder = NULL;
+    git_signature *signature = NULL;
+    git_tree *tree = NULL;
+    git_oid blob_id, tree_id, id;
+    gchar hex[GIT_OID_HEXSZ + 1];
+    gchar *input = NULL;
+
+    if ( git_repository_init(&repository, path, TRUE) < 0 )
+        goto fail;
+
+    if ( ( git_blob_create_frombuffer(&blob_id, repository, "Hello\n", strlen("Hello\n")) < 0 )
+        || ( git_treebuilder_new(&builder, repository, NULL) < 0 )
+        || ( git_treebuilder_insert(NULL, builder, "README", &blob_id, GIT_FILEMODE_BLOB) < 0 )
+        || ( git_treebuilder_write(&tree_id, builder) < 0 )
+        || ( git_tree_lookup(&tree, repository, &tree_id) < 0 )
+        || ( git_signature_now(&signature, "Jane Doe", "jane@example.com") < 0 )
+        || ( git_commit_create(&id, repository, "refs/heads/master", signature, signature, NULL, "Initial commit\n", tree, 0, NULL) < 0 ) )
+        goto fail;
+
+    git_oid_tostr(hex, sizeof(hex), &id);
+    input = g_strdup_printf("%0*d %s refs/heads/master\n", GIT_OID_HEXSZ, 0, hex);
+
+fail:
+    if ( input == NULL )
+        g_printerr("Couldn't create the repository: %s\n", ( giterr_last() != NULL ) ? giterr_last()->message : "unknown error");
+    if ( signature != NULL )
+        git_signature_free(signature);
+    if ( tree != NULL )
+        git_tree_free(tree);
+    if ( builder != NULL )
+        git_treebuilder_free(builder);
+    if ( repository != NULL )
+        git_repository_free(repository);
+    return input;
+}
+
+static gboolean
+_git_eventc_startup_run(GitEventcTestSink *sink, const gchar *hook, const gchar *path, const gchar *input, gint64 *first_event, gint64 *total)
+{
+    GError *error = NULL;
+    gchar *args[] = { (gchar *) hook, "--host", (gchar *) git_eventc_test_sink_get_host(sink), NULL };
+    GPid pid;
+    gint stdin_fd, status;
+    gint64 start, event;
+    gsize o = 0, l = strlen(input);
+
+    git_eventc_test_sink_reset(sink);
+    start = g_get_monotonic_time();
+    if ( ! g_spawn_async_with_pipes(path, args, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL, &pid, &stdin_fd, NULL, NULL, &error) )
+    {
+        g_printerr("Couldn't run %s: %s\n", hook, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    while ( o < l )
+    {
+        gssize r = write(stdin_fd, input + o, l - o);
+        if ( ( r < 0 ) && ( errno != EINTR ) )
+            break;
+        if ( r > 0 )
+            o += r;
+    }
+    g_close(stdin_fd, NULL);
+
+    event = git_eventc_test_sink_wait_first_event(sink, EVENT_TIMEOUT);
+
+    while ( waitpid(pid, &status, 0) < 0 )
+    {
+        if ( errno != EINTR )
+            return FALSE;
+    }
+    *total = g_get_monotonic_time() - start;
+    g_spawn_close_pid(pid);
+
+    if ( ! g_spawn_check_exit_status(status, &error) )
+    {
+        g_printerr("%s failed: %s\n", hook, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    if ( event == 0 )
+    {
+        g_printerr("%s sent no event\n", hook);
+        return FALSE;
+    }
+    *first_event = event - start;
+
+    return TRUE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    GitEventcTestSink *sink;
+    gchar *tmp = NULL, *path = NULL, *input = NULL;
+    gint64 first_total = 0, first_min = G_MAXINT64, first_max = 0;
+    gint64 exit_total = 0;
+    int retval = 1;
+    gsize i;
+
+    if ( argc < 2 )
+    {
+        g_printerr("Usage: %s <hook>\n", argv[0]);
+        return 1;
+    }
+
+    git_libgit2_init();
+
+    sink = git_eventc_test_sink_new(&error);
+    if ( sink == NULL )
+    {
+        g_printerr("Couldn't start the sink: %s\n", error->message);
+        g_error_free(error);
+        goto end;
+    }
+
+    tmp = g_dir_make_tmp("git-eventc-startup-XXXXXX", &error);
+    if ( tmp == NULL )
+    {
+        g_printerr("Couldn't create a temporary directory: %s\n", error->message);
+        g_error_free(error);
+        goto stop;
+    }
+
+    path = g_build_filename(tmp, "repository.git", NULL);
+    input = _git_eventc_startup_repository(path);
+    if ( input == NULL )
+        goto clean;
+
+    for ( i = 0 ; i < RUNS ; ++i )
+    {
+        gint64 first_event, total;
+
+        if ( ! _git_eventc_startup_run(sink, argv[1], path, input, &first_event, &total) )
+            goto clean;
+
+        first_total += first_event;
+        first_min = MIN(first_min, first_event);
+        first_max = MAX(first_max, first_event);
+        exit_total += total;
+    }
+    retval = 0;
+
+    g_print("startup: first event after %" G_GINT64_FORMAT " µs mean, %" G_GINT64_FORMAT " µs min, %" G_GINT64_FORMAT " µs max, exit after %" G_GINT64_FORMAT " µs mean (%d runs)\n", first_total / RUNS, first_min, first_max, exit_total / RUNS, RUNS);
+
+clean:
+    {
+        gchar *rm[] = { "rm", "-rf", tmp, NULL };
+        g_spawn_sync(NULL, rm, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, NULL, NULL);
+    }
+stop:
+    git_eventc_test_sink_free(sink);
+end:
+    g_free(input);
+    g_free(path);
+    g_free(tmp);
+    git_libgit2_shutdown();
+
+    return retval;
+}
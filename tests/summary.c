@@ -0,0 +1,203 @@
+/*
+ * git-eventc-post-receive - post-receive Git hook
+ *
+ * Copyright © 2013-2014 Quentin "Sardem FF7" Glidic
+ *
+ * This file is part of git-eventc.
+ *
+ * git-eventc is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * git-eventc is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with git-eventc. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <git2.h>
+
+#include "post-receive-summary.h"
+
+static void
+_test_authors(void)
+{
+    GHashTable *authors;
+    GVariant *names, *counts;
+    const gchar **strv;
+    const guint32 *values;
+    gsize length;
+
+    authors = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(authors, (gpointer) "Bob", GUINT_TO_POINTER(2));
+    g_hash_table_insert(authors, (gpointer) "alice", GUINT_TO_POINTER(5));
+    g_hash_table_insert(authors, (gpointer) "Carol", GUINT_TO_POINTER(2));
+    g_hash_table_insert(authors, (gpointer) "Dave", GUINT_TO_POINTER(1));
+
+    git_eventc_post_receive_summary_authors(authors, &names, &counts);
+    g_hash_table_unref(authors);
+
+    /* Most active first, ties by name */
+    strv = g_variant_get_strv(names, &length);
+    g_assert_cmpuint(length, ==, 4);
+    g_assert_cmpstr(strv[0], ==, "alice");
+    g_assert_cmpstr(strv[1], ==, "Bob");
+    g_assert_cmpstr(strv[2], ==, "Carol");
+    g_assert_cmpstr(strv[3], ==, "Dave");
+    g_free(strv);
+
+    values = g_variant_get_fixed_array(counts, &length, sizeof(guint32));
+    g_assert_cmpuint(length, ==, 4);
+    g_assert_cmpuint(values[0], ==, 5);
+    g_assert_cmpuint(values[1], ==, 2);
+    g_assert_cmpuint(values[2], ==, 2);
+    g_assert_cmpuint(values[3], ==, 1);
+
+    g_variant_unref(counts);
+    g_variant_unref(names);
+}
+
+typedef struct {
+    const gchar *name;
+    const gchar *content;
+    git_filemode_t mode;
+} GitEventcTestTreeEntry;
+
+/*
+ * Directories get a single "file" entry with the content
+ */
+static void
+_test_tree(git_repository *repository, const GitEventcTestTreeEntry *entries, git_oid *tree_id)
+{
+    git_treebuilder *builder;
+    const GitEventcTestTreeEntry *entry;
+
+    g_assert_cmpint(git_treebuilder_new(&builder, repository, NULL), ==, 0);
+    for ( entry = entries ; entry->name != NULL ; ++entry )
+    {
+        git_oid id;
+
+        if ( entry->mode == GIT_FILEMODE_TREE )
+        {
+            const GitEventcTestTreeEntry subentries[] = {
+                { .name = "file", .content = entry->content, .mode = GIT_FILEMODE_BLOB },
+                { .name = NULL },
+            };
+            _test_tree(repository, subentries, &id);
+        }
+        else
+            g_assert_cmpint(git_blob_create_frombuffer(&id, repository, entry->content, strlen(entry->content)), ==, 0);
+        g_assert_cmpint(git_treebuilder_insert(NULL, builder, entry->name, &id, entry->mode), ==, 0);
+    }
+    g_assert_cmpint(git_treebuilder_write(tree_id, builder), ==, 0);
+    git_treebuilder_free(builder);
+}
+
+static void
+_test_commit(git_repository *repository, const GitEventcTestTreeEntry *entries, git_oid *id)
+{
+    git_signature *signature;
+    git_tree *tree;
+    git_oid tree_id;
+
+    _test_tree(repository, entries, &tree_id);
+    g_assert_cmpint(git_tree_lookup(&tree, repository, &tree_id), ==, 0);
+    g_assert_cmpint(git_signature_new(&signature, "Jane Doe", "jane@example.com", 0, 0), ==, 0);
+    g_assert_cmpint(git_commit_create(id, repository, NULL, signature, signature, NULL, "Commit\n", tree, 0, NULL), ==, 0);
+    git_signature_free(signature);
+    git_tree_free(tree);
+}
+
+static void
+_test_top_level_changes(void)
+{
+    static const GitEventcTestTreeEntry from_entries[] = {
+        { .name = "a.txt", .content = "a\n", .mode = GIT_FILEMODE_BLOB },
+        { .name = "b.txt", .content = "b\n", .mode = GIT_FILEMODE_BLOB },
+        { .name = "c.txt", .content = "c\n", .mode = GIT_FILEMODE_BLOB },
+        { .name = "dir", .content = "x\n", .mode = GIT_FILEMODE_TREE },
+        { .name = "old", .content = "o\n", .mode = GIT_FILEMODE_TREE },
+        { .name = "run.sh", .content = "true\n", .mode = GIT_FILEMODE_BLOB },
+        { .name = "same", .content = "s\n", .mode = GIT_FILEMODE_TREE },
+        { .name = NULL },
+    };
+    static const GitEventcTestTreeEntry to_entries[] = {
+        { .name = "b.txt", .content = "B\n", .mode = GIT_FILEMODE_BLOB },
+        { .name = "c.txt", .content = "c\n", .mode = GIT_FILEMODE_BLOB },
+        { .name = "dir", .content = "X\n", .mode = GIT_FILEMODE_TREE },
+        { .name = "new.txt", .content = "n\n", .mode = GIT_FILEMODE_BLOB },
+        { .name = "run.sh", .content = "true\n", .mode = GIT_FILEMODE_BLOB_EXECUTABLE },
+        { .name = "same", .content = "s\n", .mode = GIT_FILEMODE_TREE },
+        { .name = NULL },
+    };
+    static const gchar * const expected[] = {
+        "a.txt",
+        "b.txt",
+        "dir/",
+        "new.txt",
+        "old/",
+        "run.sh",
+        NULL
+    };
+    GError *error = NULL;
+    git_repository *repository;
+    gchar *tmp, *path;
+    git_oid from, to;
+    GVariant *changes;
+    const gchar **strv;
+    gsize length, i;
+
+    tmp = g_dir_make_tmp("git-eventc-summary-XXXXXX", &error);
+    g_assert_no_error(error);
+    path = g_build_filename(tmp, "repository.git", NULL);
+    g_assert_cmpint(git_repository_init(&repository, path, TRUE), ==, 0);
+
+    _test_commit(repository, from_entries, &from);
+    _test_commit(repository, to_entries, &to);
+
+    changes = git_eventc_post_receive_summary_top_level_changes(repository, &from, &to);
+    g_assert_nonnull(changes);
+    strv = g_variant_get_strv(changes, &length);
+    g_assert_cmpuint(length, ==, G_N_ELEMENTS(expected) - 1);
+    for ( i = 0 ; i < length ; ++i )
+        g_assert_cmpstr(strv[i], ==, expected[i]);
+    g_free(strv);
+    g_variant_unref(changes);
+
+    /* Unknown commits give nothing rather than a partial list */
+    git_oid_fromstr(&from, "0123456789012345678901234567890123456789");
+    g_assert_null(git_eventc_post_receive_summary_top_level_changes(repository, &from, &to));
+
+    git_repository_free(repository);
+
+    gchar *rm[] = { "rm", "-rf", tmp, NULL };
+    g_spawn_sync(NULL, rm, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL, NULL, NULL);
+    g_free(path);
+    g_free(tmp);
+}
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    git_libgit2_init();
+
+    g_test_add_func("/summary/authors", _test_authors);
+    g_test_add_func("/summary/top-level-changes", _test_top_level_changes);
+
+    gint ret = g_test_run();
+    git_libgit2_shutdown();
+    return ret;
+}